@@ -0,0 +1,317 @@
+#include "BVH.h"
+
+#include <limits>
+
+#include "Simd.h"
+
+namespace
+{
+	constexpr int binCount = 16;
+	constexpr float traversalCost = 2.0f; // relative to testing one leafWidth batch of spheres, measured on the random scenes
+
+	class Bounds
+	{
+	public:
+		Vector3 min = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+		Vector3 max = { std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest() };
+
+		void grow(const Vector3& point)
+		{
+			min = { std::min(min.x, point.x), std::min(min.y, point.y), std::min(min.z, point.z) };
+			max = { std::max(max.x, point.x), std::max(max.y, point.y), std::max(max.z, point.z) };
+		}
+
+		void grow(const Bounds& other)
+		{
+			// an empty bin would turn the sweep bounds infinite
+			if (other.min.x > other.max.x)
+				return;
+
+			grow(other.min);
+			grow(other.max);
+		}
+
+		void grow(const Sphere& sphere)
+		{
+			const Vector3 extent = { sphere.radius, sphere.radius, sphere.radius };
+			grow(sphere.center - extent);
+			grow(sphere.center + extent);
+		}
+
+		float surfaceArea() const
+		{
+			const Vector3 extent = max - min;
+			if (extent.x < 0)
+				return 0;
+
+			return 2 * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+		}
+	};
+}
+
+void BVH::build(const std::vector<Sphere>& spheres, int leafWidth)
+{
+	this->leafWidth = leafWidth;
+	nodes.clear();
+	primitiveIndices.resize(spheres.size());
+	for (size_t i = 0; i < spheres.size(); i++)
+	{
+		primitiveIndices[i] = static_cast<int>(i);
+	}
+
+	if (spheres.empty())
+		return;
+
+	nodes.reserve(2 * spheres.size());
+	buildRecursive(spheres, 0, static_cast<int>(spheres.size()), 0);
+}
+
+int BVH::buildRecursive(const std::vector<Sphere>& spheres, int first, int count, int depth)
+{
+	const int nodeIndex = static_cast<int>(nodes.size());
+	nodes.emplace_back();
+
+	Bounds bounds;
+	Bounds centroidBounds;
+	for (int i = first; i < first + count; i++)
+	{
+		const Sphere& sphere = spheres[primitiveIndices[i]];
+		bounds.grow(sphere);
+		centroidBounds.grow(sphere.center);
+	}
+
+	nodes[nodeIndex].boundsMin = bounds.min;
+	nodes[nodeIndex].boundsMax = bounds.max;
+	nodes[nodeIndex].offset = first;
+	nodes[nodeIndex].count = count;
+
+	if (count <= 1)
+		return nodeIndex;
+
+	if (depth >= maxSahDepth)
+	{
+		// degenerate distributions (e.g. exponentially spaced spheres) make SAH peel off one sphere per level, so deep
+		// nodes are halved at the centroid median instead, which bounds the depth by the traversal stack size
+		if (count <= maxLeafSize)
+			return nodeIndex;
+
+		const Vector3 extent = centroidBounds.max - centroidBounds.min;
+		const int axis = extent.x > extent.y && extent.x > extent.z ? 0 : (extent.y > extent.z ? 1 : 2);
+		int* begin = primitiveIndices.data() + first;
+		std::nth_element(begin, begin + count / 2, begin + count, [&](int a, int b)
+		{
+			return spheres[a].center[axis] < spheres[b].center[axis];
+		});
+
+		buildRecursive(spheres, first, count / 2, depth + 1);
+		const int rightChild = buildRecursive(spheres, first + count / 2, count - count / 2, depth + 1);
+		nodes[nodeIndex].offset = rightChild;
+		nodes[nodeIndex].count = 0;
+		return nodeIndex;
+	}
+
+	// bin the centroids along each axis and pick the split plane with the lowest SAH cost
+	float bestCost = std::numeric_limits<float>::max();
+	int bestAxis = -1;
+	int bestBin = 0;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const float axisMin = centroidBounds.min[axis];
+		const float axisExtent = centroidBounds.max[axis] - axisMin;
+		if (axisExtent <= 0)
+			continue;
+
+		Bounds binBounds[binCount];
+		int binCounts[binCount] = {};
+		const float binScale = binCount / axisExtent;
+
+		for (int i = first; i < first + count; i++)
+		{
+			const Sphere& sphere = spheres[primitiveIndices[i]];
+			const int bin = std::min(static_cast<int>((sphere.center[axis] - axisMin) * binScale), binCount - 1);
+			binBounds[bin].grow(sphere);
+			binCounts[bin]++;
+		}
+
+		// sweep from the right to get the area and count of every right-hand partition
+		float rightAreas[binCount - 1];
+		int rightCounts[binCount - 1];
+		Bounds rightBounds;
+		int rightCount = 0;
+		for (int bin = binCount - 1; bin > 0; bin--)
+		{
+			rightBounds.grow(binBounds[bin]);
+			rightCount += binCounts[bin];
+			rightAreas[bin - 1] = rightBounds.surfaceArea();
+			rightCounts[bin - 1] = rightCount;
+		}
+
+		Bounds leftBounds;
+		int leftCount = 0;
+		for (int bin = 0; bin < binCount - 1; bin++)
+		{
+			leftBounds.grow(binBounds[bin]);
+			leftCount += binCounts[bin];
+			if (leftCount == 0 || rightCounts[bin] == 0)
+				continue;
+
+			const float cost = leftCount * leftBounds.surfaceArea() + rightCounts[bin] * rightAreas[bin];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = bin;
+			}
+		}
+	}
+
+	const float parentArea = bounds.surfaceArea();
+	const float leafCost = static_cast<float>((count + leafWidth - 1) / leafWidth);
+	const float splitCost = parentArea > 0 ? traversalCost + bestCost / (parentArea * leafWidth) : leafCost;
+
+	// the SAH decides where to stop, the cap only bounds the linear scan of a leaf whose split looks no cheaper
+	if (bestAxis < 0 || (count <= std::max(maxLeafSize, leafWidth) && splitCost >= leafCost))
+		return nodeIndex;
+
+	// partition the primitive indices around the chosen bin boundary
+	const float axisMin = centroidBounds.min[bestAxis];
+	const float binScale = binCount / (centroidBounds.max[bestAxis] - axisMin);
+	int* middle = std::partition(primitiveIndices.data() + first, primitiveIndices.data() + first + count, [&](int index)
+	{
+		const int bin = std::min(static_cast<int>((spheres[index].center[bestAxis] - axisMin) * binScale), binCount - 1);
+		return bin <= bestBin;
+	});
+
+	const int leftCount = static_cast<int>(middle - (primitiveIndices.data() + first));
+	buildRecursive(spheres, first, leftCount, depth + 1);
+	const int rightChild = buildRecursive(spheres, first + leftCount, count - leftCount, depth + 1);
+
+	nodes[nodeIndex].offset = rightChild;
+	nodes[nodeIndex].count = 0;
+	return nodeIndex;
+}
+
+float BVH::intersectBounds(const BVHNode& node, const Vector3& origin, const RayPacket& packet)
+{
+	float nearest = noHit;
+
+#if defined(RAYTRACER_SIMD_AVX2) || defined(RAYTRACER_SIMD_SSE)
+	using namespace Simd;
+	static_assert(RayPacket::size % width == 0, "packet rays must fill whole vectors");
+
+	// the box corners relative to the shared origin are the same for every ray
+	const FloatV minX = broadcast(node.boundsMin.x - origin.x);
+	const FloatV minY = broadcast(node.boundsMin.y - origin.y);
+	const FloatV minZ = broadcast(node.boundsMin.z - origin.z);
+	const FloatV maxX = broadcast(node.boundsMax.x - origin.x);
+	const FloatV maxY = broadcast(node.boundsMax.y - origin.y);
+	const FloatV maxZ = broadcast(node.boundsMax.z - origin.z);
+	const FloatV zero = broadcast(0.0f);
+	FloatV entry = broadcast(noHit);
+
+	for (int base = 0; base < RayPacket::size; base += width)
+	{
+		const FloatV inverseX = load(&packet.inverseX[base]);
+		const FloatV inverseY = load(&packet.inverseY[base]);
+		const FloatV inverseZ = load(&packet.inverseZ[base]);
+
+		const FloatV tx1 = mul(minX, inverseX);
+		const FloatV tx2 = mul(maxX, inverseX);
+		FloatV tMin = Simd::min(tx1, tx2);
+		FloatV tMax = Simd::max(tx1, tx2);
+
+		const FloatV ty1 = mul(minY, inverseY);
+		const FloatV ty2 = mul(maxY, inverseY);
+		tMin = Simd::max(tMin, Simd::min(ty1, ty2));
+		tMax = Simd::min(tMax, Simd::max(ty1, ty2));
+
+		const FloatV tz1 = mul(minZ, inverseZ);
+		const FloatV tz2 = mul(maxZ, inverseZ);
+		tMin = Simd::max(tMin, Simd::min(tz1, tz2));
+		tMax = Simd::min(tMax, Simd::max(tz1, tz2));
+
+		const FloatV hit = bitAnd(bitAnd(lessEqual(tMin, tMax), lessEqual(zero, tMax)), lessEqual(tMin, load(&packet.closest[base])));
+		entry = Simd::min(entry, select(hit, tMin, broadcast(noHit)));
+	}
+
+	float entries[width];
+	store(entries, entry);
+	for (const float distance : entries)
+		nearest = std::min(nearest, distance);
+#else
+	for (int lane = 0; lane < RayPacket::size; lane++)
+	{
+		const Vector3 inverseDirection = { packet.inverseX[lane], packet.inverseY[lane], packet.inverseZ[lane] };
+		nearest = std::min(nearest, intersectBounds(node, origin, inverseDirection, packet.closest[lane]));
+	}
+#endif
+
+	return nearest;
+}
+
+float BVH::intersectBounds(const BVHNode& node, const QueuePacket& packet)
+{
+	float nearest = noHit;
+
+#if defined(RAYTRACER_SIMD_AVX2) || defined(RAYTRACER_SIMD_SSE)
+	using namespace Simd;
+	static_assert(QueuePacket::size % width == 0, "packet rays must fill whole vectors");
+
+	const FloatV boundsMinX = broadcast(node.boundsMin.x);
+	const FloatV boundsMinY = broadcast(node.boundsMin.y);
+	const FloatV boundsMinZ = broadcast(node.boundsMin.z);
+	const FloatV boundsMaxX = broadcast(node.boundsMax.x);
+	const FloatV boundsMaxY = broadcast(node.boundsMax.y);
+	const FloatV boundsMaxZ = broadcast(node.boundsMax.z);
+	const FloatV zero = broadcast(0.0f);
+	FloatV entry = broadcast(noHit);
+
+	for (int base = 0; base < QueuePacket::size; base += width)
+	{
+		const FloatV originX = load(&packet.originX[base]);
+		const FloatV originY = load(&packet.originY[base]);
+		const FloatV originZ = load(&packet.originZ[base]);
+		const FloatV inverseX = load(&packet.inverseX[base]);
+		const FloatV inverseY = load(&packet.inverseY[base]);
+		const FloatV inverseZ = load(&packet.inverseZ[base]);
+
+		const FloatV tx1 = mul(sub(boundsMinX, originX), inverseX);
+		const FloatV tx2 = mul(sub(boundsMaxX, originX), inverseX);
+		FloatV tMin = Simd::min(tx1, tx2);
+		FloatV tMax = Simd::max(tx1, tx2);
+
+		const FloatV ty1 = mul(sub(boundsMinY, originY), inverseY);
+		const FloatV ty2 = mul(sub(boundsMaxY, originY), inverseY);
+		tMin = Simd::max(tMin, Simd::min(ty1, ty2));
+		tMax = Simd::min(tMax, Simd::max(ty1, ty2));
+
+		const FloatV tz1 = mul(sub(boundsMinZ, originZ), inverseZ);
+		const FloatV tz2 = mul(sub(boundsMaxZ, originZ), inverseZ);
+		tMin = Simd::max(tMin, Simd::min(tz1, tz2));
+		tMax = Simd::min(tMax, Simd::max(tz1, tz2));
+
+		// inactive lanes have a negative closest distance and never hit
+		const FloatV closest = load(&packet.closest[base]);
+		const FloatV hit = bitAnd(bitAnd(lessEqual(tMin, tMax), lessEqual(zero, tMax)), bitAnd(lessEqual(tMin, closest), lessEqual(zero, closest)));
+		entry = Simd::min(entry, select(hit, tMin, broadcast(noHit)));
+	}
+
+	float entries[width];
+	store(entries, entry);
+	for (const float distance : entries)
+		nearest = std::min(nearest, distance);
+#else
+	for (int lane = 0; lane < QueuePacket::size; lane++)
+	{
+		if (!packet.isActive(lane))
+			continue;
+
+		const Vector3 origin = { packet.originX[lane], packet.originY[lane], packet.originZ[lane] };
+		const Vector3 inverseDirection = { packet.inverseX[lane], packet.inverseY[lane], packet.inverseZ[lane] };
+		nearest = std::min(nearest, intersectBounds(node, origin, inverseDirection, packet.closest[lane]));
+	}
+#endif
+
+	return nearest;
+}
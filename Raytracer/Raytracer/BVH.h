@@ -0,0 +1,368 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "QueuePacket.h"
+#include "RayPacket.h"
+#include "RayStats.h"
+#include "Sphere.h"
+#include "Vector3.h"
+
+class BVHNode
+{
+public:
+	Vector3 boundsMin;
+	Vector3 boundsMax;
+	int offset; // leaf: first entry in primitiveIndices, interior: index of the second child (the first child follows its parent)
+	int count; // number of primitives in a leaf, 0 for interior nodes
+};
+
+// bounding volume hierarchy over the scene spheres, built with the surface area heuristic
+// and stored as a flattened depth-first node array
+class BVH
+{
+public:
+	static constexpr int maxLeafSize = 16; // leaves up to this size are only split where the SAH says it pays
+	// nodes deeper than maxSahDepth are split at the median, so no leaf is deeper than maxSahDepth plus the 31 halvings
+	// of an int count and the traversal stacks, which hold at most one entry per level plus the root, cannot overflow
+	static constexpr int maxSahDepth = 32;
+	static constexpr int stackSize = 64;
+	static_assert(maxSahDepth + 32 <= stackSize, "the deepest possible leaf must fit the traversal stacks");
+
+	std::vector<BVHNode> nodes;
+	std::vector<int> primitiveIndices; // sphere indices in leaf order
+
+	// leafWidth is how many spheres the leaf kernel tests at once, leaves are sized and costed in batches of it
+	void build(const std::vector<Sphere>& spheres, int leafWidth);
+	bool empty() const { return nodes.empty(); }
+
+	// visits the leaves hit by the ray front-to-back, skipping nodes that start behind closest.
+	// intersectLeaf(first, count, closest) tests primitiveIndices[first, first + count) and may shrink closest
+	template<typename F>
+	void traverse(const Vector3& origin, const Vector3& direction, float& closest, F&& intersectLeaf) const
+	{
+		if (nodes.empty())
+			return;
+
+		const Vector3 inverseDirection = { 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+
+		// one far child per level at most, the build keeps the depth below stackSize
+		int stack[stackSize];
+		float stackDistances[stackSize];
+		int stackTop = 0;
+		int nodeIndex = 0;
+		int visitedNodes = 0;
+
+		if (intersectBounds(nodes[0], origin, inverseDirection, closest) == noHit)
+			return;
+
+		while (true)
+		{
+			visitedNodes++;
+			const BVHNode& node = nodes[nodeIndex];
+			if (node.count > 0)
+			{
+				intersectLeaf(node.offset, node.count, closest);
+			}
+			else
+			{
+				int nearChild = nodeIndex + 1;
+				int farChild = node.offset;
+				float nearDistance = intersectBounds(nodes[nearChild], origin, inverseDirection, closest);
+				float farDistance = intersectBounds(nodes[farChild], origin, inverseDirection, closest);
+
+				if (farDistance < nearDistance)
+				{
+					std::swap(nearChild, farChild);
+					std::swap(nearDistance, farDistance);
+				}
+
+				if (nearDistance != noHit)
+				{
+					if (farDistance != noHit)
+					{
+						stack[stackTop] = farChild;
+						stackDistances[stackTop++] = farDistance;
+					}
+
+					nodeIndex = nearChild;
+					continue;
+				}
+			}
+
+			// pop the next pending node, dropping the ones that start behind the closest hit found so far
+			bool found = false;
+			while (stackTop > 0 && !found)
+			{
+				--stackTop;
+				nodeIndex = stack[stackTop];
+				found = stackDistances[stackTop] <= closest;
+			}
+
+			if (!found)
+				break;
+		}
+
+		RAYTRACER_COUNT(nodesVisited, visitedNodes);
+	}
+
+	// any-hit query for occlusion rays: stops as soon as intersectLeaf(first, count) reports a blocker,
+	// visiting children in memory order since the closest blocker is irrelevant
+	template<typename F>
+	bool traverseAny(const Vector3& origin, const Vector3& direction, float maxDistance, F&& intersectLeaf) const
+	{
+		if (nodes.empty())
+			return false;
+
+		const Vector3 inverseDirection = { 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+
+		// one sibling per level plus the root at most, the build keeps the depth below stackSize
+		int stack[stackSize];
+		int stackTop = 0;
+		stack[stackTop++] = 0;
+		int visitedNodes = 0;
+		bool occluded = false;
+
+		while (stackTop > 0 && !occluded)
+		{
+			visitedNodes++;
+			const int nodeIndex = stack[--stackTop];
+			const BVHNode& node = nodes[nodeIndex];
+			if (intersectBounds(node, origin, inverseDirection, maxDistance) == noHit)
+				continue;
+
+			if (node.count > 0)
+			{
+				occluded = intersectLeaf(node.offset, node.count);
+			}
+			else
+			{
+				stack[stackTop++] = node.offset;
+				stack[stackTop++] = nodeIndex + 1;
+			}
+		}
+
+		RAYTRACER_COUNT(nodesVisited, visitedNodes);
+		return occluded;
+	}
+
+	// visits the leaves whose boxes may overlap the cone of rays from origin bounded by four planes through origin,
+	// inside where normal * (p - origin) >= 0, and closer than maxDistance; stops as soon as intersectLeaf(first, count)
+	// returns true. Conservative: boxes outside the cone near its edges may be visited as well
+	template<typename F>
+	bool traverseFrustum(const Vector3& origin, const Vector3 (&normals)[4], float maxDistance, F&& intersectLeaf) const
+	{
+		if (nodes.empty())
+			return false;
+
+		// one sibling per level plus the root at most, the build keeps the depth below stackSize
+		int stack[stackSize];
+		int stackTop = 0;
+		stack[stackTop++] = 0;
+		int visitedNodes = 0;
+		bool found = false;
+
+		while (stackTop > 0 && !found)
+		{
+			visitedNodes++;
+			const int nodeIndex = stack[--stackTop];
+			const BVHNode& node = nodes[nodeIndex];
+			if (!overlapsFrustum(node, origin, normals, maxDistance))
+				continue;
+
+			if (node.count > 0)
+			{
+				found = intersectLeaf(node.offset, node.count);
+			}
+			else
+			{
+				stack[stackTop++] = node.offset;
+				stack[stackTop++] = nodeIndex + 1;
+			}
+		}
+
+		RAYTRACER_COUNT(nodesVisited, visitedNodes);
+		return found;
+	}
+
+	// closest-hit traversal for a packet of rays sharing origin: a node is entered if any ray of the packet hits its
+	// box before that ray's closest hit, and leaves are handed to intersectLeaf(first, count) which updates the packet
+	template<typename F>
+	void traversePacket(const Vector3& origin, RayPacket& packet, F&& intersectLeaf) const
+	{
+		traverseClosest(packet, [&](const BVHNode& node) { return intersectBounds(node, origin, packet); }, intersectLeaf);
+	}
+
+	// traversePacket for rays with their own origins, inactive lanes take no part
+	template<typename F>
+	void traversePacket(QueuePacket& packet, F&& intersectLeaf) const
+	{
+		traverseClosest(packet, [&](const BVHNode& node) { return intersectBounds(node, packet); }, intersectLeaf);
+	}
+
+	// any-hit query for a packet of occlusion rays, visiting children in memory order like traverseAny; a node is
+	// entered if any active ray hits its box, and intersectLeaf(first, count) deactivates the occluded rays and returns
+	// true once none is left, which ends the traversal
+	template<typename F>
+	void traversePacketAny(QueuePacket& packet, F&& intersectLeaf) const
+	{
+		if (nodes.empty())
+			return;
+
+		// one sibling per level plus the root at most, the build keeps the depth below stackSize
+		int stack[stackSize];
+		int stackTop = 0;
+		stack[stackTop++] = 0;
+		int visitedNodes = 0;
+		bool occluded = false;
+
+		while (stackTop > 0 && !occluded)
+		{
+			visitedNodes++;
+			const int nodeIndex = stack[--stackTop];
+			const BVHNode& node = nodes[nodeIndex];
+			if (intersectBounds(node, packet) == noHit)
+				continue;
+
+			if (node.count > 0)
+			{
+				occluded = intersectLeaf(node.offset, node.count);
+			}
+			else
+			{
+				stack[stackTop++] = node.offset;
+				stack[stackTop++] = nodeIndex + 1;
+			}
+		}
+
+		RAYTRACER_COUNT(nodesVisited, visitedNodes);
+	}
+
+private:
+	static constexpr float noHit = 3.402823466e+38f;
+
+	// slab test, returns the entry distance or noHit if the box is missed or starts beyond maxDistance
+	static float intersectBounds(const BVHNode& node, const Vector3& origin, const Vector3& inverseDirection, float maxDistance)
+	{
+		const float tx1 = (node.boundsMin.x - origin.x) * inverseDirection.x;
+		const float tx2 = (node.boundsMax.x - origin.x) * inverseDirection.x;
+		float tMin = std::min(tx1, tx2);
+		float tMax = std::max(tx1, tx2);
+
+		const float ty1 = (node.boundsMin.y - origin.y) * inverseDirection.y;
+		const float ty2 = (node.boundsMax.y - origin.y) * inverseDirection.y;
+		tMin = std::max(tMin, std::min(ty1, ty2));
+		tMax = std::min(tMax, std::max(ty1, ty2));
+
+		const float tz1 = (node.boundsMin.z - origin.z) * inverseDirection.z;
+		const float tz2 = (node.boundsMax.z - origin.z) * inverseDirection.z;
+		tMin = std::max(tMin, std::min(tz1, tz2));
+		tMax = std::min(tMax, std::max(tz1, tz2));
+
+		if (tMax < tMin || tMax < 0 || tMin > maxDistance)
+			return noHit;
+
+		return tMin;
+	}
+
+	// false if the box lies entirely outside one of the planes (tested at its corner furthest along the normal) or
+	// entirely beyond maxDistance
+	static bool overlapsFrustum(const BVHNode& node, const Vector3& origin, const Vector3 (&normals)[4], float maxDistance)
+	{
+		const Vector3 boundsMin = node.boundsMin - origin;
+		const Vector3 boundsMax = node.boundsMax - origin;
+		for (const Vector3& normal : normals)
+		{
+			const Vector3 corner = { normal.x >= 0 ? boundsMax.x : boundsMin.x, normal.y >= 0 ? boundsMax.y : boundsMin.y,
+				normal.z >= 0 ? boundsMax.z : boundsMin.z };
+			if (normal * corner < 0)
+				return false;
+		}
+
+		// nearest point of the box to the origin
+		const Vector3 nearest = { std::clamp(0.0f, boundsMin.x, boundsMax.x), std::clamp(0.0f, boundsMin.y, boundsMax.y),
+			std::clamp(0.0f, boundsMin.z, boundsMax.z) };
+		return nearest * nearest <= maxDistance * maxDistance;
+	}
+
+	// packet slab test, returns the nearest entry distance over the rays that hit the box before their closest hit,
+	// or noHit if there are none
+	static float intersectBounds(const BVHNode& node, const Vector3& origin, const RayPacket& packet);
+	// the same over the active rays of a packet with per-ray origins
+	static float intersectBounds(const BVHNode& node, const QueuePacket& packet);
+
+	// shared loop of the traversePacket overloads, boundsEntry(node) is the packet slab test
+	template<typename P, typename B, typename F>
+	void traverseClosest(P& packet, B&& boundsEntry, F&& intersectLeaf) const
+	{
+		if (nodes.empty())
+			return;
+
+		// one far child per level at most like traverse, the build keeps the depth below stackSize
+		int stack[stackSize];
+		float stackDistances[stackSize];
+		int stackTop = 0;
+		int nodeIndex = 0;
+		int visitedNodes = 0;
+		float farthest = packet.getFarthestClosest();
+
+		if (boundsEntry(nodes[0]) == noHit)
+			return;
+
+		while (true)
+		{
+			visitedNodes++;
+			const BVHNode& node = nodes[nodeIndex];
+			if (node.count > 0)
+			{
+				intersectLeaf(node.offset, node.count);
+				farthest = packet.getFarthestClosest();
+			}
+			else
+			{
+				int nearChild = nodeIndex + 1;
+				int farChild = node.offset;
+				float nearDistance = boundsEntry(nodes[nearChild]);
+				float farDistance = boundsEntry(nodes[farChild]);
+
+				if (farDistance < nearDistance)
+				{
+					std::swap(nearChild, farChild);
+					std::swap(nearDistance, farDistance);
+				}
+
+				if (nearDistance != noHit)
+				{
+					if (farDistance != noHit)
+					{
+						stack[stackTop] = farChild;
+						stackDistances[stackTop++] = farDistance;
+					}
+
+					nodeIndex = nearChild;
+					continue;
+				}
+			}
+
+			// the stored distance is the nearest entry of any ray, so a node is only dropped once every ray has a
+			// closer hit
+			bool found = false;
+			while (stackTop > 0 && !found)
+			{
+				--stackTop;
+				nodeIndex = stack[stackTop];
+				found = stackDistances[stackTop] <= farthest;
+			}
+
+			if (!found)
+				break;
+		}
+
+		RAYTRACER_COUNT(nodesVisited, visitedNodes);
+	}
+
+	int leafWidth = 1;
+
+	int buildRecursive(const std::vector<Sphere>& spheres, int first, int count, int depth);
+};
@@ -0,0 +1,409 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Camera.h"
+#include "Framebuffer.h"
+#include "Quaternion.h"
+#include "Raytracer.h"
+#include "SphereGeometry.h"
+#include "ToneMapper.h"
+
+// micro benchmarks of the tracing kernels and full-frame macro benchmarks on fixed scenes and camera poses
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	class BenchmarkOptions
+	{
+	public:
+		int width = 800;
+		int height = 600;
+		int frames = 30;
+		std::string filter;
+	};
+
+	// results are folded into this so the compiler cannot drop the timed work
+	volatile float sink = 0;
+
+	bool isSelected(const BenchmarkOptions& options, const std::string& name)
+	{
+		return options.filter.empty() || name.find(options.filter) != std::string::npos;
+	}
+
+	// runs body(iterations) with a growing iteration count until one batch takes long enough to time reliably
+	void runMicro(const BenchmarkOptions& options, const std::string& name, const std::function<float(int)>& body)
+	{
+		if (!isSelected(options, name))
+			return;
+
+		int iterations = 1024;
+		double seconds = 0;
+		while (true)
+		{
+			const auto start = Clock::now();
+			sink = sink + body(iterations);
+			seconds = std::chrono::duration<double>(Clock::now() - start).count();
+			if (seconds > 0.2 || iterations >= (1 << 28))
+				break;
+
+			iterations *= 4;
+		}
+
+		std::printf("%-32s %10.2f ns/op\n", name.c_str(), seconds * 1e9 / iterations);
+	}
+
+	Vector3 randomUnitVector(std::mt19937& random)
+	{
+		std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+		Vector3 vector = { distribution(random), distribution(random), distribution(random) + 1.5f };
+		vector.normalize();
+		return vector;
+	}
+
+	void runMicroBenchmarks(const BenchmarkOptions& options)
+	{
+		std::printf("micro benchmarks\n");
+
+		constexpr int count = 1024;
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+		std::vector<Vector3> directions(count);
+		std::vector<Vector3> normals(count);
+		std::vector<Sphere> spheres(count);
+		std::vector<Color> colors(count);
+		for (int i = 0; i < count; i++)
+		{
+			directions[i] = randomUnitVector(random);
+			normals[i] = randomUnitVector(random);
+			spheres[i] = { { unit(random) * 4 - 2, unit(random) * 4 - 2, 3 + unit(random) * 4 }, 0.2f + unit(random), 0 };
+			colors[i] = { static_cast<uint8_t>(unit(random) * 255), static_cast<uint8_t>(unit(random) * 255), static_cast<uint8_t>(unit(random) * 255), 0 };
+		}
+
+		const Vector3 origin = { 0, 0, 0 };
+		const Vector3 view = { 0, 0, -1 };
+
+		runMicro(options, "intersectRaySphere", [&](int iterations)
+		{
+			float total = 0;
+			for (int i = 0; i < iterations; i++)
+				total += Raytracer::intersectRaySphere(origin, directions[i & (count - 1)], spheres[(i * 7) & (count - 1)]);
+			return total;
+		});
+
+		SphereGeometry geometry;
+		std::vector<int> order(count);
+		for (int i = 0; i < count; i++)
+			order[i] = i;
+		geometry.build(spheres, order);
+
+		runMicro(options, "SphereGeometry::intersectClosest", [&](int iterations)
+		{
+			// one op is one ray against one vector-width batch of spheres
+			float total = 0;
+			for (int i = 0; i < iterations; i++)
+			{
+				float closest = std::numeric_limits<float>::max();
+				const int first = (i * SphereGeometry::simdWidth) & (count - 1);
+				total += static_cast<float>(geometry.intersectClosest(origin, directions[i & (count - 1)], first, SphereGeometry::simdWidth, 0.01f, closest));
+			}
+			return total;
+		});
+
+		runMicro(options, "SphereGeometry::intersectPacket", [&](int iterations)
+		{
+			// one op fills a packet and tests it against one vector-width batch of spheres
+			RayPacket packet;
+			float total = 0;
+			for (int i = 0; i < iterations; i++)
+			{
+				for (int lane = 0; lane < RayPacket::size; lane++)
+					packet.setRay(lane, directions[(i + lane) & (count - 1)], std::numeric_limits<float>::max());
+
+				const int first = (i * SphereGeometry::simdWidth) & (count - 1);
+				geometry.intersectPacket(origin, packet, first, SphereGeometry::simdWidth, 0.01f);
+				total += static_cast<float>(packet.slots[0]);
+			}
+			return total;
+		});
+
+		runMicro(options, "SphereGeometry::occludes", [&](int iterations)
+		{
+			float total = 0;
+			for (int i = 0; i < iterations; i++)
+			{
+				const int first = (i * SphereGeometry::simdWidth) & (count - 1);
+				total += geometry.occludes(origin, directions[i & (count - 1)], first, SphereGeometry::simdWidth, 0.01f, 100.0f) ? 1.0f : 0.0f;
+			}
+			return total;
+		});
+
+		runMicro(options, "computeBlinPhong", [&](int iterations)
+		{
+			float total = 0;
+			for (int i = 0; i < iterations; i++)
+				total += Raytracer::computeBlinPhong(directions[i & (count - 1)], normals[(i * 3) & (count - 1)], view, 0.5f, 0.8f, 50.0f);
+			return total;
+		});
+
+		runMicro(options, "reflectRay", [&](int iterations)
+		{
+			float total = 0;
+			for (int i = 0; i < iterations; i++)
+				total += Raytracer::reflectRay(directions[i & (count - 1)], normals[(i * 3) & (count - 1)]).x;
+			return total;
+		});
+
+		runMicro(options, "Vector3::normalized", [&](int iterations)
+		{
+			float total = 0;
+			for (int i = 0; i < iterations; i++)
+				total += (directions[i & (count - 1)] * 3.0f).normalized().z;
+			return total;
+		});
+
+		runMicro(options, "Vector3::cross", [&](int iterations)
+		{
+			float total = 0;
+			for (int i = 0; i < iterations; i++)
+				total += directions[i & (count - 1)].cross(normals[(i * 3) & (count - 1)]).y;
+			return total;
+		});
+
+		runMicro(options, "Quaternion::rotate", [&](int iterations)
+		{
+			const Quaternion rotation = Quaternion::fromAxisAngle({ 0, 1, 0 }, 0.3f);
+			float total = 0;
+			for (int i = 0; i < iterations; i++)
+				total += (rotation * directions[i & (count - 1)]).x;
+			return total;
+		});
+
+		runMicro(options, "PixelLayout::pack", [&](int iterations)
+		{
+			const PixelLayout layout;
+			uint32_t total = 0;
+			for (int i = 0; i < iterations; i++)
+				total += layout.pack(colors[i & (count - 1)]);
+			return static_cast<float>(total);
+		});
+
+		runMicro(options, "PixelLayout::packSpan (per pixel)", [&](int iterations)
+		{
+			// default layout is BGRA in memory, the byte-swapping path
+			const PixelLayout layout;
+			std::vector<uint32_t> packed(count);
+			for (int i = 0; i < iterations; i += count)
+				layout.packSpan(colors.data(), count, packed.data());
+			return static_cast<float>(packed[iterations & (count - 1)]);
+		});
+
+		// HDR colors up to twice the white, so the clamping and the operator see values on both sides of 1
+		std::vector<FloatColor> floatColors(count);
+		for (int i = 0; i < count; i++)
+			floatColors[i] = FloatColor::fromColor(colors[i]) * 2.0f;
+
+		runMicro(options, "FloatColor blend", [&](int iterations)
+		{
+			// how shadeHit folds a reflection into the local color of a surface
+			FloatColor total = { 0, 0, 0, 0 };
+			for (int i = 0; i < iterations; i++)
+				total += floatColors[i & (count - 1)] * 0.7f + floatColors[(i * 3) & (count - 1)] * 0.3f;
+			return total.g;
+		});
+
+		const auto runToneMap = [&](const char* name, const ToneMapper& toneMapper)
+		{
+			runMicro(options, name, [&](int iterations)
+			{
+				std::vector<Color> mapped(count);
+				for (int i = 0; i < iterations; i += count)
+					toneMapper.map(floatColors.data(), count, mapped.data());
+				return static_cast<float>(mapped[iterations & (count - 1)].g);
+			});
+		};
+
+		runToneMap("ToneMapper::map (per pixel)", ToneMapper());
+		ToneMapper reinhardGamma;
+		reinhardGamma.setOperator(ToneMapOperator::Reinhard);
+		reinhardGamma.setGamma(2.2f);
+		runToneMap("ToneMapper::map reinhard gamma", reinhardGamma);
+	}
+
+	// deterministic field of random spheres in front of the default camera
+	void createRandomScene(Raytracer& raytracer, int sphereCount)
+	{
+		std::mt19937 random(42);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+		std::vector<Material> materials;
+		for (int i = 0; i < 16; i++)
+		{
+			const Color color = { static_cast<uint8_t>(unit(random) * 255), static_cast<uint8_t>(unit(random) * 255), static_cast<uint8_t>(unit(random) * 255), 0 };
+			materials.push_back({ color, unit(random), unit(random) * 100, unit(random) * 0.8f });
+		}
+
+		std::vector<Sphere> spheres;
+		for (int i = 0; i < sphereCount; i++)
+		{
+			const Vector3 center = { unit(random) * 40 - 20, unit(random) * 30 - 15, 5 + unit(random) * 60 };
+			spheres.push_back({ center, 0.2f + unit(random) * 0.8f, static_cast<int>(random() % materials.size()) });
+		}
+
+		raytracer.setMaterials(materials);
+		raytracer.setSpheres(spheres);
+	}
+
+	// configure, if given, switches tracer features after the scene is set up; move, if given, changes the camera before
+	// every frame including the warm-up one
+	void runMacroBenchmark(const BenchmarkOptions& options, const std::string& name, int sphereCount, const Vector3& position, float yaw, float pitch,
+		const std::function<void(Raytracer&)>& configure = {}, const std::function<void(Camera&)>& move = {})
+	{
+		if (!isSelected(options, name))
+			return;
+
+		Camera camera;
+		camera.position = position;
+		camera.rotate(yaw, pitch);
+
+		const float aspectRatio = static_cast<float>(options.width) / options.height;
+		Raytracer raytracer(camera, 0.01f, std::numeric_limits<float>::max(), aspectRatio, 45.f);
+		if (sphereCount > 0)
+			createRandomScene(raytracer, sphereCount);
+		if (configure)
+			configure(raytracer);
+
+		std::vector<uint32_t> pixels(static_cast<size_t>(options.width) * options.height);
+		Framebuffer framebuffer;
+		framebuffer.pixels = pixels.data();
+		framebuffer.width = options.width;
+		framebuffer.height = options.height;
+		framebuffer.pitch = options.width * 4;
+
+		// one warm-up frame, then the timed ones
+		if (move)
+			move(camera);
+		raytracer.render(framebuffer);
+
+		std::vector<double> frameTimes;
+		RayCounters counters;
+		for (int frame = 0; frame < options.frames; frame++)
+		{
+			if (move)
+				move(camera);
+			const auto start = Clock::now();
+			raytracer.render(framebuffer);
+			frameTimes.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+			counters.add(raytracer.getFrameStats());
+		}
+
+		std::sort(frameTimes.begin(), frameTimes.end());
+		const auto percentile = [&](double p)
+		{
+			return frameTimes[std::min(frameTimes.size() - 1, static_cast<size_t>(p * frameTimes.size()))];
+		};
+
+		double totalMilliseconds = 0;
+		for (const double time : frameTimes)
+			totalMilliseconds += time;
+
+		const double meanMilliseconds = totalMilliseconds / frameTimes.size();
+		const double pixelCount = static_cast<double>(options.width) * options.height;
+		std::printf("%-28s mean %8.2f ms  p50 %8.2f  p90 %8.2f  p99 %8.2f  %8.1f ns/pixel  %7.2f Mpixels/s",
+			name.c_str(), meanMilliseconds, percentile(0.5), percentile(0.9), percentile(0.99),
+			meanMilliseconds * 1e6 / pixelCount, pixelCount / (meanMilliseconds * 1e3));
+#if RAYTRACER_ENABLE_STATS
+		// traced rays, which differ from the pixels when adaptive sampling interpolates some of them; all includes shadow
+		// and reflection rays
+		std::printf("  %7.2f Mrays/s (primary)  %7.2f Mrays/s (all)", counters.primaryRays / (totalMilliseconds * 1e3),
+			counters.getTotalRays() / (totalMilliseconds * 1e3));
+#endif
+		std::printf("\n");
+	}
+
+	void runMacroBenchmarks(const BenchmarkOptions& options)
+	{
+		std::printf("frame benchmarks (%dx%d, %d frames)\n", options.width, options.height, options.frames);
+		runMacroBenchmark(options, "default-scene", 0, { 0, 0, 0 }, 0, 0);
+		runMacroBenchmark(options, "default-scene-side", 0, { -3, 1, 1 }, -40, 15);
+		runMacroBenchmark(options, "random-1k", 1000, { 0, 0, 0 }, 0, 0);
+		runMacroBenchmark(options, "random-10k", 10000, { 0, 0, 0 }, 0, 0);
+
+		const auto adaptive = [](Raytracer& raytracer) { raytracer.setAdaptive(true); };
+		runMacroBenchmark(options, "default-scene-adaptive", 0, { 0, 0, 0 }, 0, 0, adaptive);
+		runMacroBenchmark(options, "random-1k-adaptive", 1000, { 0, 0, 0 }, 0, 0, adaptive);
+
+		// one primary ray at a time, baselines for the packet tracing of default-scene and random-1k
+		const auto single = [](Raytracer& raytracer) { raytracer.setPacketTracing(false); };
+		runMacroBenchmark(options, "default-scene-single", 0, { 0, 0, 0 }, 0, 0, single);
+		runMacroBenchmark(options, "random-1k-single", 1000, { 0, 0, 0 }, 0, 0, single);
+
+		const auto wavefront = [](Raytracer& raytracer) { raytracer.setWavefront(true); };
+		runMacroBenchmark(options, "default-scene-wavefront", 0, { 0, 0, 0 }, 0, 0, wavefront);
+		runMacroBenchmark(options, "random-1k-wavefront", 1000, { 0, 0, 0 }, 0, 0, wavefront);
+		// shadow and reflection rays in pixel order, baselines for the ray sorting
+		const auto unsorted = [](Raytracer& raytracer)
+		{
+			raytracer.setWavefront(true);
+			raytracer.setRaySorting(false);
+		};
+		runMacroBenchmark(options, "random-1k-wavefront-unsorted", 1000, { 0, 0, 0 }, 0, 0, unsorted);
+		runMacroBenchmark(options, "random-10k-wavefront", 10000, { 0, 0, 0 }, 0, 0, wavefront);
+		runMacroBenchmark(options, "random-10k-wavefront-unsorted", 10000, { 0, 0, 0 }, 0, 0, unsorted);
+
+		const auto roulette = [](Raytracer& raytracer) { raytracer.setRussianRoulette(true); };
+		runMacroBenchmark(options, "random-1k-roulette", 1000, { 0, 0, 0 }, 0, 0, roulette);
+
+		// temporal reuse only has something to reproject while the camera moves, the *-moving runs are its baselines
+		const auto pan = [](Camera& camera)
+		{
+			camera.position.x += 0.01f;
+			camera.rotate(0.3f, 0.1f);
+		};
+		const auto temporal = [](Raytracer& raytracer) { raytracer.setTemporalReuse(true); };
+		runMacroBenchmark(options, "default-scene-moving", 0, { 0, 0, 0 }, 0, 0, {}, pan);
+		runMacroBenchmark(options, "default-scene-temporal", 0, { 0, 0, 0 }, 0, 0, temporal, pan);
+		runMacroBenchmark(options, "random-1k-moving", 1000, { 0, 0, 0 }, 0, 0, {}, pan);
+		runMacroBenchmark(options, "random-1k-temporal", 1000, { 0, 0, 0 }, 0, 0, temporal, pan);
+	}
+
+	bool parseOptions(int argc, char* argv[], BenchmarkOptions& options)
+	{
+		for (int i = 1; i + 1 < argc; i += 2)
+		{
+			if (std::strcmp(argv[i], "--width") == 0)
+				options.width = std::max(1, std::atoi(argv[i + 1]));
+			else if (std::strcmp(argv[i], "--height") == 0)
+				options.height = std::max(1, std::atoi(argv[i + 1]));
+			else if (std::strcmp(argv[i], "--frames") == 0)
+				options.frames = std::max(1, std::atoi(argv[i + 1]));
+			else if (std::strcmp(argv[i], "--filter") == 0)
+				options.filter = argv[i + 1];
+			else
+				return false;
+		}
+
+		return argc % 2 == 1;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	BenchmarkOptions options;
+	if (!parseOptions(argc, argv, options))
+	{
+		std::fprintf(stderr, "usage: RaytracerBenchmark [--width N] [--height N] [--frames N] [--filter name]\n");
+		return 1;
+	}
+
+	runMicroBenchmarks(options);
+	runMacroBenchmarks(options);
+	return 0;
+}
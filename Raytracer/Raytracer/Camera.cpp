@@ -1,6 +1,6 @@
 #include "Camera.h"
 
-#include <SDL_stdinc.h>
+#include <numbers>
 
 Camera::Camera(): position(Vector3(0, 0, 0)), orientation(Quaternion()), forward(Vector3(0, 0, 1)), up(Vector3(0, 1, 0)), right(Vector3(1, 0, 0))
 {
@@ -9,8 +9,8 @@ Camera::Camera(): position(Vector3(0, 0, 0)), orientation(Quaternion()), forward
 
 void Camera::rotate(float deltaYaw, float deltaPitch)
 {
-	const float yawRadians = deltaYaw * M_PI / 180.0f;
-	const float pitchRadians = deltaPitch * M_PI / 180.0f;
+	const float yawRadians = deltaYaw * std::numbers::pi / 180.0f;
+	const float pitchRadians = deltaPitch * std::numbers::pi / 180.0f;
 
 	const Quaternion yawRotation = Quaternion::fromAxisAngle(Vector3(0, 1, 0), yawRadians); // yaw around the global up axis
 	const Quaternion pitchRotation = Quaternion::fromAxisAngle(Vector3(1, 0, 0), pitchRadians); // pitch around the global right axis
@@ -1,15 +1,8 @@
 #pragma once
-#include <SDL_stdinc.h>
+#include <cstdint>
 
 class Color
 {
 public:
-	Uint8 r, g, b, a;
-
-	Color operator*(float scalar) const;
-	void clampMultiplyFloat(float term);
-	void clampMultiplyColor(const Color& other);
-	void clampAdd(const Color& other);
-	Color operator*(const Color& other) const;
-	Color operator+(const Color& other) const;
+	uint8_t r, g, b, a;
 };
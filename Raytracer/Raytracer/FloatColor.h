@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Color.h"
+
+// linear RGB of the shading pipeline with 1 as the 8-bit white; channels are not clamped, so light brighter than white
+// survives reflections and accumulation until the ToneMapper quantizes it; a is padding so a color fills one 128-bit
+// vector
+class FloatColor
+{
+public:
+	float r, g, b, a;
+
+	static FloatColor fromColor(const Color& color)
+	{
+		constexpr float scale = 1.0f / 255;
+		return { color.r * scale, color.g * scale, color.b * scale, 0 };
+	}
+
+	FloatColor operator*(float scalar) const
+	{
+		return { r * scalar, g * scalar, b * scalar, a };
+	}
+
+	FloatColor operator*(const FloatColor& other) const
+	{
+		return { r * other.r, g * other.g, b * other.b, a };
+	}
+
+	FloatColor operator+(const FloatColor& other) const
+	{
+		return { r + other.r, g + other.g, b + other.b, a };
+	}
+
+	FloatColor& operator+=(const FloatColor& other)
+	{
+		r += other.r;
+		g += other.g;
+		b += other.b;
+		return *this;
+	}
+};
@@ -0,0 +1,67 @@
+#include "Framebuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define RAYTRACER_PACK_SSE
+#endif
+
+static_assert(sizeof(Color) == 4, "packSpan reads colors as 32-bit words");
+
+void PixelLayout::packSpan(const Color* colors, int count, uint32_t* out) const
+{
+	// as a little-endian word a Color is r | g << 8 | b << 16 | a << 24
+	const bool alphaInPlace = alphaMask == 0 || alphaShift == 24;
+	const bool sameOrder = redShift == 0 && greenShift == 8 && blueShift == 16 && alphaInPlace;
+	const bool swappedOrder = redShift == 16 && greenShift == 8 && blueShift == 0 && alphaInPlace;
+	if (!sameOrder && !swappedOrder)
+	{
+		for (int i = 0; i < count; i++)
+			out[i] = pack(colors[i]);
+		return;
+	}
+
+	const uint32_t keepMask = 0x00FFFFFF | alphaMask;
+	int i = 0;
+
+#if defined(RAYTRACER_PACK_SSE)
+	const __m128i keep = _mm_set1_epi32(static_cast<int>(keepMask));
+	const __m128i greenAlpha = _mm_set1_epi32(static_cast<int>(0xFF00FF00u));
+	const __m128i lowByte = _mm_set1_epi32(0xFF);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(colors + i));
+		if (swappedOrder)
+		{
+			const __m128i red = _mm_slli_epi32(_mm_and_si128(pixels, lowByte), 16);
+			const __m128i blue = _mm_and_si128(_mm_srli_epi32(pixels, 16), lowByte);
+			pixels = _mm_or_si128(_mm_and_si128(pixels, greenAlpha), _mm_or_si128(red, blue));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_and_si128(pixels, keep));
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		uint32_t pixel;
+		std::memcpy(&pixel, &colors[i], sizeof(pixel));
+		if (swappedOrder)
+			pixel = (pixel & 0xFF00FF00u) | (pixel & 0xFF) << 16 | (pixel >> 16 & 0xFF);
+		out[i] = pixel & keepMask;
+	}
+}
+
+void Framebuffer::setSpan(int x, int y, const FloatColor* colors, int count, const ToneMapper& toneMapper) const
+{
+	// small enough to stay in L1 between the tone mapping and the packing
+	constexpr int chunkSize = 64;
+	Color chunk[chunkSize];
+	for (int i = 0; i < count; i += chunkSize)
+	{
+		const int chunkCount = std::min(chunkSize, count - i);
+		toneMapper.map(colors + i, chunkCount, chunk);
+		layout.packSpan(chunk, chunkCount, getRow(y) + x + i);
+	}
+}
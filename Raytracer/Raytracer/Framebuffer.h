@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Color.h"
+#include "FloatColor.h"
+#include "ToneMapper.h"
+
+// bit positions of the 8-bit channels inside one 32-bit pixel, alpha is dropped by formats without it
+class PixelLayout
+{
+public:
+	int redShift = 16;
+	int greenShift = 8;
+	int blueShift = 0;
+	int alphaShift = 24;
+	uint32_t alphaMask = 0;
+
+	uint32_t pack(const Color& color) const
+	{
+		return static_cast<uint32_t>(color.r) << redShift
+			| static_cast<uint32_t>(color.g) << greenShift
+			| static_cast<uint32_t>(color.b) << blueShift
+			| (static_cast<uint32_t>(color.a) << alphaShift & alphaMask);
+	}
+
+	// packs count colors into out; the RGBA and BGRA byte orders (SDL ABGR8888/RGB888/ARGB8888 on little-endian)
+	// are converted four pixels at a time, other layouts fall back to pack()
+	void packSpan(const Color* colors, int count, uint32_t* out) const;
+};
+
+// caller-owned 32-bit pixel memory the tracer renders into, e.g. a locked SDL streaming texture or a plain buffer
+class Framebuffer
+{
+public:
+	void* pixels = nullptr;
+	int width = 0;
+	int height = 0;
+	int pitch = 0; // bytes between the starts of two rows
+	PixelLayout layout;
+
+	uint32_t* getRow(int y) const
+	{
+		return reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(pixels) + static_cast<ptrdiff_t>(y) * pitch);
+	}
+
+	void setPixel(int x, int y, const Color& color) const
+	{
+		getRow(y)[x] = layout.pack(color);
+	}
+
+	// writes count pixels of row y starting at x
+	void setSpan(int x, int y, const Color* colors, int count) const
+	{
+		layout.packSpan(colors, count, getRow(y) + x);
+	}
+
+	// tone maps count float colors and writes them to row y starting at x
+	void setSpan(int x, int y, const FloatColor* colors, int count, const ToneMapper& toneMapper) const;
+};
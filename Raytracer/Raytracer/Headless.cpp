@@ -0,0 +1,192 @@
+#include "Headless.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+#include "Camera.h"
+#include "Image.h"
+#include "Profiler.h"
+#include "Raytracer.h"
+
+namespace
+{
+	void printUsage()
+	{
+		std::cerr << "usage: Raytracer --headless [--width N] [--height N] [--position x,y,z] [--yaw degrees] [--pitch degrees]"
+			" [--fov degrees] [--samples N] [--output file.ppm|file.png|file.pfm] [--trace trace.json]"
+			" [--heatmap file] [--heatmap-metric time|rays] [--min-throughput weight] [--roulette on|off]"
+			" [--exposure scale] [--tonemap clamp|reinhard] [--gamma value]" << std::endl;
+	}
+}
+
+bool isHeadlessRequested(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "--headless") == 0)
+			return true;
+	}
+
+	return false;
+}
+
+bool parseHeadlessOptions(int argc, char* argv[], HeadlessOptions& options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		if (std::strcmp(arg, "--headless") == 0)
+			continue;
+
+		if (i + 1 >= argc)
+		{
+			std::cerr << "Missing value for " << arg << std::endl;
+			printUsage();
+			return false;
+		}
+
+		const char* value = argv[++i];
+		bool valid = true;
+		if (std::strcmp(arg, "--width") == 0)
+			valid = std::sscanf(value, "%d", &options.width) == 1 && options.width > 0;
+		else if (std::strcmp(arg, "--height") == 0)
+			valid = std::sscanf(value, "%d", &options.height) == 1 && options.height > 0;
+		else if (std::strcmp(arg, "--position") == 0)
+			valid = std::sscanf(value, "%f,%f,%f", &options.position.x, &options.position.y, &options.position.z) == 3;
+		else if (std::strcmp(arg, "--yaw") == 0)
+			valid = std::sscanf(value, "%f", &options.yaw) == 1;
+		else if (std::strcmp(arg, "--pitch") == 0)
+			valid = std::sscanf(value, "%f", &options.pitch) == 1;
+		else if (std::strcmp(arg, "--fov") == 0)
+			valid = std::sscanf(value, "%f", &options.fov) == 1 && options.fov > 0 && options.fov < 180;
+		else if (std::strcmp(arg, "--samples") == 0)
+			valid = std::sscanf(value, "%d", &options.samplesPerPixel) == 1 && options.samplesPerPixel > 0;
+		else if (std::strcmp(arg, "--output") == 0)
+			options.outputPath = value;
+		else if (std::strcmp(arg, "--trace") == 0)
+			options.tracePath = value;
+		else if (std::strcmp(arg, "--heatmap") == 0)
+			options.heatmapPath = value;
+		else if (std::strcmp(arg, "--heatmap-metric") == 0)
+		{
+			valid = std::strcmp(value, "time") == 0 || std::strcmp(value, "rays") == 0;
+			options.heatmapMetric = std::strcmp(value, "rays") == 0 ? RenderMode::RayHeatmap : RenderMode::TimeHeatmap;
+#if !RAYTRACER_ENABLE_STATS
+			// the ray counts would all be zero and the heatmap black
+			if (options.heatmapMetric == RenderMode::RayHeatmap)
+			{
+				std::cerr << "--heatmap-metric rays needs the ray counters, which this build compiles out (RAYTRACER_STATS=OFF)" << std::endl;
+				return false;
+			}
+#endif
+		}
+		else if (std::strcmp(arg, "--min-throughput") == 0)
+			valid = std::sscanf(value, "%f", &options.minThroughput) == 1 && options.minThroughput >= 0;
+		else if (std::strcmp(arg, "--roulette") == 0)
+		{
+			valid = std::strcmp(value, "on") == 0 || std::strcmp(value, "off") == 0;
+			options.russianRoulette = std::strcmp(value, "on") == 0;
+		}
+		else if (std::strcmp(arg, "--exposure") == 0)
+			valid = std::sscanf(value, "%f", &options.exposure) == 1 && options.exposure > 0;
+		else if (std::strcmp(arg, "--tonemap") == 0)
+		{
+			valid = std::strcmp(value, "clamp") == 0 || std::strcmp(value, "reinhard") == 0;
+			options.toneMapOperator = std::strcmp(value, "reinhard") == 0 ? ToneMapOperator::Reinhard : ToneMapOperator::Clamp;
+		}
+		else if (std::strcmp(arg, "--gamma") == 0)
+			valid = std::sscanf(value, "%f", &options.gamma) == 1 && options.gamma > 0;
+		else
+		{
+			std::cerr << "Unknown option " << arg << std::endl;
+			printUsage();
+			return false;
+		}
+
+		if (!valid)
+		{
+			std::cerr << "Invalid value for " << arg << ": " << value << std::endl;
+			printUsage();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int runHeadless(const HeadlessOptions& options)
+{
+	Camera camera;
+	camera.position = options.position;
+	camera.rotate(options.yaw, options.pitch);
+
+	constexpr float minDistance = 0.01f;
+	constexpr float maxDistance = std::numeric_limits<float>::max();
+	const float aspectRatio = static_cast<float>(options.width) / options.height;
+	Raytracer raytracer(camera, minDistance, maxDistance, aspectRatio, options.fov);
+	raytracer.setMinThroughput(options.minThroughput);
+	raytracer.setRussianRoulette(options.russianRoulette);
+
+	if (!options.tracePath.empty())
+	{
+		Profiler::setThreadName("main");
+		Profiler::start();
+	}
+
+	Image image(options.width, options.height);
+	const auto start = std::chrono::steady_clock::now();
+	{
+		PROFILE_SCOPE("renderImage");
+		raytracer.renderImage(image, options.samplesPerPixel);
+	}
+	const auto end = std::chrono::steady_clock::now();
+
+	const double milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+	std::cout << "Rendered " << options.width << "x" << options.height << " at " << options.samplesPerPixel
+		<< " spp in " << milliseconds << "ms" << std::endl;
+#if RAYTRACER_ENABLE_STATS
+	std::cout << RayStats::format(raytracer.getFrameStats(), milliseconds) << std::endl;
+#endif
+
+	ToneMapper toneMapper;
+	toneMapper.setExposure(options.exposure);
+	toneMapper.setOperator(options.toneMapOperator);
+	toneMapper.setGamma(options.gamma);
+	if (!image.save(options.outputPath, toneMapper))
+	{
+		std::cerr << "Failed to write " << options.outputPath << std::endl;
+		return 1;
+	}
+
+	std::cout << "Wrote " << options.outputPath << std::endl;
+
+	if (!options.heatmapPath.empty())
+	{
+		Image heatmap(options.width, options.height);
+		raytracer.renderHeatmap(heatmap, options.heatmapMetric);
+		if (!heatmap.save(options.heatmapPath))
+		{
+			std::cerr << "Failed to write " << options.heatmapPath << std::endl;
+			return 1;
+		}
+
+		std::cout << "Wrote " << options.heatmapPath << std::endl;
+	}
+
+	if (!options.tracePath.empty())
+	{
+		Profiler::stop();
+		if (!Profiler::writeChromeTrace(options.tracePath))
+		{
+			std::cerr << "Failed to write " << options.tracePath << std::endl;
+			return 1;
+		}
+
+		std::cout << "Wrote " << options.tracePath << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+
+#include "RenderMode.h"
+#include "ToneMapper.h"
+#include "Vector3.h"
+
+class HeadlessOptions
+{
+public:
+	int width = 800;
+	int height = 600;
+	Vector3 position = { 0, 0, 0 };
+	float yaw = 0; // degrees, same convention as Camera::rotate
+	float pitch = 0;
+	float fov = 45.f;
+	int samplesPerPixel = 1;
+	std::string outputPath = "render.ppm";
+	std::string tracePath; // Chrome trace JSON of the render, empty to skip profiling
+	std::string heatmapPath; // per-pixel cost heatmap written after the render, empty to skip it
+	RenderMode heatmapMetric = RenderMode::TimeHeatmap;
+	float minThroughput = 0.5f / 255; // reflections weighted below this are not traced
+	bool russianRoulette = false;
+	// tone mapping of the 8-bit outputs, PFM files keep the linear colors
+	float exposure = 1.0f;
+	ToneMapOperator toneMapOperator = ToneMapOperator::Clamp;
+	float gamma = 1.0f;
+};
+
+// true if the command line asks for an offline render instead of the interactive window
+bool isHeadlessRequested(int argc, char* argv[]);
+bool parseHeadlessOptions(int argc, char* argv[], HeadlessOptions& options);
+// renders a single frame into memory and writes it to options.outputPath, returns the process exit code
+int runHeadless(const HeadlessOptions& options);
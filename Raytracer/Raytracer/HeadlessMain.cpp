@@ -0,0 +1,11 @@
+#include "Headless.h"
+
+// entry point of the SDL-free command line renderer, takes the same flags as Raytracer --headless
+int main(int argc, char* argv[])
+{
+	HeadlessOptions options;
+	if (!parseHeadlessOptions(argc, argv, options))
+		return 1;
+
+	return runHeadless(options);
+}
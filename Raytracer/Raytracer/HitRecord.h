@@ -0,0 +1,11 @@
+#pragma once
+#include "Vector3.h"
+
+// result of a closest-hit query; the primitive indexes the scene spheres and its material is looked up separately
+class HitRecord
+{
+public:
+	float t;
+	int primitive = -1;
+	Vector3 normal; // unit surface normal at the hit point, only valid if primitive >= 0
+};
@@ -0,0 +1,192 @@
+#include "Image.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+	uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc = 0)
+	{
+		static uint32_t table[256] = {};
+		if (table[1] == 0)
+		{
+			for (uint32_t i = 0; i < 256; i++)
+			{
+				uint32_t value = i;
+				for (int bit = 0; bit < 8; bit++)
+					value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+
+				table[i] = value;
+			}
+		}
+
+		crc = ~crc;
+		for (size_t i = 0; i < size; i++)
+			crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+		return ~crc;
+	}
+
+	void appendBigEndian(std::vector<unsigned char>& out, uint32_t value)
+	{
+		out.push_back(static_cast<unsigned char>(value >> 24));
+		out.push_back(static_cast<unsigned char>(value >> 16));
+		out.push_back(static_cast<unsigned char>(value >> 8));
+		out.push_back(static_cast<unsigned char>(value));
+	}
+
+	void writeChunk(std::ofstream& file, const char* type, const std::vector<unsigned char>& data)
+	{
+		std::vector<unsigned char> chunk;
+		appendBigEndian(chunk, static_cast<uint32_t>(data.size()));
+		chunk.insert(chunk.end(), type, type + 4);
+		chunk.insert(chunk.end(), data.begin(), data.end());
+		appendBigEndian(chunk, crc32(chunk.data() + 4, chunk.size() - 4));
+		file.write(reinterpret_cast<const char*>(chunk.data()), static_cast<std::streamsize>(chunk.size()));
+	}
+
+	bool hasExtension(const std::string& path, const std::string& extension)
+	{
+		if (path.size() < extension.size())
+			return false;
+
+		return std::equal(extension.rbegin(), extension.rend(), path.rbegin(), [](char a, char b)
+		{
+			return a == std::tolower(static_cast<unsigned char>(b));
+		});
+	}
+}
+
+Image::Image(int width, int height): width(width), height(height), pixels(static_cast<size_t>(width) * height * 3, 0.0f)
+{
+}
+
+bool Image::save(const std::string& path, const ToneMapper& toneMapper) const
+{
+	if (hasExtension(path, ".png"))
+		return savePNG(path, toneMapper);
+	if (hasExtension(path, ".pfm"))
+		return savePFM(path);
+	if (hasExtension(path, ".ppm"))
+		return savePPM(path, toneMapper);
+
+	std::cerr << "Unsupported image format: " << path << std::endl;
+	return false;
+}
+
+bool Image::savePPM(const std::string& path, const ToneMapper& toneMapper) const
+{
+	std::ofstream file(path, std::ios::binary);
+	if (!file)
+		return false;
+
+	const std::vector<unsigned char> rgb = toRGB8(toneMapper);
+	file << "P6\n" << width << " " << height << "\n255\n";
+	file.write(reinterpret_cast<const char*>(rgb.data()), static_cast<std::streamsize>(rgb.size()));
+	return static_cast<bool>(file);
+}
+
+bool Image::savePNG(const std::string& path, const ToneMapper& toneMapper) const
+{
+	std::ofstream file(path, std::ios::binary);
+	if (!file)
+		return false;
+
+	// every scanline starts with filter type 0 (none)
+	const std::vector<unsigned char> rgb = toRGB8(toneMapper);
+	const size_t rowSize = static_cast<size_t>(width) * 3;
+	std::vector<unsigned char> raw;
+	raw.reserve((rowSize + 1) * height);
+	for (int y = 0; y < height; y++)
+	{
+		raw.push_back(0);
+		raw.insert(raw.end(), rgb.begin() + y * rowSize, rgb.begin() + (y + 1) * rowSize);
+	}
+
+	// zlib stream made of uncompressed deflate blocks, this is about getting pixels out without a dependency, not file size
+	std::vector<unsigned char> zlib = { 0x78, 0x01 };
+	uint32_t adlerA = 1;
+	uint32_t adlerB = 0;
+	size_t offset = 0;
+	do
+	{
+		const size_t blockSize = std::min<size_t>(raw.size() - offset, 65535);
+		const bool last = offset + blockSize == raw.size();
+		zlib.push_back(last ? 1 : 0);
+		zlib.push_back(static_cast<unsigned char>(blockSize & 0xFF));
+		zlib.push_back(static_cast<unsigned char>(blockSize >> 8));
+		zlib.push_back(static_cast<unsigned char>(~blockSize & 0xFF));
+		zlib.push_back(static_cast<unsigned char>((~blockSize >> 8) & 0xFF));
+
+		for (size_t i = offset; i < offset + blockSize; i++)
+		{
+			adlerA = (adlerA + raw[i]) % 65521;
+			adlerB = (adlerB + adlerA) % 65521;
+		}
+
+		zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + blockSize);
+		offset += blockSize;
+	} while (offset < raw.size());
+	appendBigEndian(zlib, (adlerB << 16) | adlerA);
+
+	std::vector<unsigned char> header;
+	appendBigEndian(header, static_cast<uint32_t>(width));
+	appendBigEndian(header, static_cast<uint32_t>(height));
+	header.insert(header.end(), { 8, 2, 0, 0, 0 }); // 8 bit, truecolor, deflate, adaptive filtering, no interlace
+
+	constexpr unsigned char signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+	writeChunk(file, "IHDR", header);
+	writeChunk(file, "IDAT", zlib);
+	writeChunk(file, "IEND", {});
+	return static_cast<bool>(file);
+}
+
+bool Image::savePFM(const std::string& path) const
+{
+	std::ofstream file(path, std::ios::binary);
+	if (!file)
+		return false;
+
+	// negative scale marks little-endian data, rows are stored bottom to top
+	file << "PF\n" << width << " " << height << "\n-1.0\n";
+	for (int y = height - 1; y >= 0; y--)
+	{
+		file.write(reinterpret_cast<const char*>(getPixel(0, y)), static_cast<std::streamsize>(width * 3 * sizeof(float)));
+	}
+
+	return static_cast<bool>(file);
+}
+
+std::vector<unsigned char> Image::toRGB8(const ToneMapper& toneMapper) const
+{
+	// pixels are padded to FloatColor a chunk at a time so the file goes through the same pass as the framebuffer
+	constexpr int chunkSize = 64;
+	FloatColor colors[chunkSize];
+	Color mapped[chunkSize];
+	const int pixelCount = width * height;
+	std::vector<unsigned char> rgb(pixels.size());
+	for (int first = 0; first < pixelCount; first += chunkSize)
+	{
+		const int count = std::min(chunkSize, pixelCount - first);
+		for (int i = 0; i < count; i++)
+		{
+			const float* pixel = &pixels[static_cast<size_t>(first + i) * 3];
+			colors[i] = { pixel[0], pixel[1], pixel[2], 0 };
+		}
+
+		toneMapper.map(colors, count, mapped);
+		for (int i = 0; i < count; i++)
+		{
+			unsigned char* out = &rgb[static_cast<size_t>(first + i) * 3];
+			out[0] = mapped[i].r;
+			out[1] = mapped[i].g;
+			out[2] = mapped[i].b;
+		}
+	}
+
+	return rgb;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "ToneMapper.h"
+
+// caller-owned linear RGB float image for offline rendering, 3 floats per pixel, rows top to bottom
+class Image
+{
+public:
+	int width = 0;
+	int height = 0;
+	std::vector<float> pixels;
+
+	Image() = default;
+	Image(int width, int height);
+
+	float* getPixel(int x, int y) { return &pixels[(static_cast<size_t>(y) * width + x) * 3]; }
+	const float* getPixel(int x, int y) const { return &pixels[(static_cast<size_t>(y) * width + x) * 3]; }
+
+	// picks the format from the file extension (.ppm, .png or .pfm); the 8-bit formats go through the tone mapper,
+	// PFM keeps the linear values
+	bool save(const std::string& path, const ToneMapper& toneMapper = ToneMapper()) const;
+	bool savePPM(const std::string& path, const ToneMapper& toneMapper = ToneMapper()) const;
+	bool savePNG(const std::string& path, const ToneMapper& toneMapper = ToneMapper()) const;
+	bool savePFM(const std::string& path) const;
+
+private:
+	std::vector<unsigned char> toRGB8(const ToneMapper& toneMapper) const;
+};
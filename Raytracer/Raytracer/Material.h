@@ -0,0 +1,11 @@
+#pragma once
+#include "Color.h"
+
+class Material
+{
+public:
+	Color color;
+	float lambert;
+	float specular;
+	float reflectivity;
+};
@@ -0,0 +1,120 @@
+#include "Profiler.h"
+
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+	class alignas(64) ThreadTrace
+	{
+	public:
+		int id = 0;
+		std::string name;
+		std::unique_ptr<ProfileEvent[]> events = std::make_unique<ProfileEvent[]>(Profiler::eventCapacity);
+		std::atomic<uint64_t> head = 0; // total events ever written, the slot is head modulo the capacity
+	};
+
+	const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+	std::mutex registryMutex;
+	std::vector<std::unique_ptr<ThreadTrace>> registry;
+
+	// buffers are only allocated on a thread's first recorded event, so naming a thread costs nothing while idle
+	thread_local ThreadTrace* localTrace = nullptr;
+	thread_local std::string localName;
+
+	ThreadTrace& registerThread()
+	{
+		// traces outlive their threads so events from finished workers are still exported
+		std::unique_lock<std::mutex> lock(registryMutex);
+		registry.push_back(std::make_unique<ThreadTrace>());
+		ThreadTrace& trace = *registry.back();
+		trace.id = static_cast<int>(registry.size());
+		trace.name = localName.empty() ? "thread " + std::to_string(trace.id) : localName;
+		localTrace = &trace;
+		return trace;
+	}
+
+	void writeEscaped(std::ofstream& file, const std::string& text)
+	{
+		for (const char c : text)
+		{
+			if (c == '"' || c == '\\')
+				file << '\\';
+			file << c;
+		}
+	}
+}
+
+std::atomic<bool> Profiler::recording = false;
+
+void Profiler::start()
+{
+	recording.store(true, std::memory_order_relaxed);
+}
+
+void Profiler::stop()
+{
+	recording.store(false, std::memory_order_relaxed);
+}
+
+int64_t Profiler::now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Profiler::record(const char* name, int64_t start, int64_t duration)
+{
+	ThreadTrace& trace = localTrace ? *localTrace : registerThread();
+	const uint64_t head = trace.head.load(std::memory_order_relaxed);
+	trace.events[head & (eventCapacity - 1)] = { name, start, duration };
+	trace.head.store(head + 1, std::memory_order_release);
+}
+
+void Profiler::setThreadName(const std::string& name)
+{
+	localName = name;
+	if (localTrace)
+	{
+		std::unique_lock<std::mutex> lock(registryMutex);
+		localTrace->name = name;
+	}
+}
+
+bool Profiler::writeChromeTrace(const std::string& path)
+{
+	std::ofstream file(path);
+	if (!file)
+		return false;
+
+	std::unique_lock<std::mutex> lock(registryMutex);
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+	bool first = true;
+	for (const auto& trace : registry)
+	{
+		file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << trace->id << ",\"args\":{\"name\":\"";
+		writeEscaped(file, trace->name);
+		file << "\"}}";
+		first = false;
+
+		// timestamps and durations are in microseconds, fractions keep the ns resolution
+		const uint64_t head = trace->head.load(std::memory_order_acquire);
+		const uint64_t begin = head > eventCapacity ? head - eventCapacity : 0;
+		for (uint64_t i = begin; i < head; i++)
+		{
+			const ProfileEvent& event = trace->events[i & (eventCapacity - 1)];
+			file << ",\n{\"name\":\"";
+			writeEscaped(file, event.name);
+			file << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << trace->id
+				<< ",\"ts\":" << event.start / 1000 << "." << (event.start % 1000) / 100
+				<< ",\"dur\":" << event.duration / 1000 << "." << (event.duration % 1000) / 100 << "}";
+		}
+	}
+
+	file << "\n]}\n";
+	return static_cast<bool>(file);
+}
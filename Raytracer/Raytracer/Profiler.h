@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// scoped timing is compiled in unless the build sets RAYTRACER_ENABLE_PROFILER=0
+#ifndef RAYTRACER_ENABLE_PROFILER
+#define RAYTRACER_ENABLE_PROFILER 1
+#endif
+
+#define RAYTRACER_PROFILE_CONCAT_INNER(a, b) a##b
+#define RAYTRACER_PROFILE_CONCAT(a, b) RAYTRACER_PROFILE_CONCAT_INNER(a, b)
+
+#if RAYTRACER_ENABLE_PROFILER
+// times the rest of the enclosing block, name must be a string literal
+#define PROFILE_SCOPE(name) const ProfileScope RAYTRACER_PROFILE_CONCAT(profileScope, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#endif
+
+class ProfileEvent
+{
+public:
+	const char* name = nullptr;
+	int64_t start = 0; // ns since the profiler epoch
+	int64_t duration = 0;
+};
+
+// records timed scopes into one ring buffer per thread; the owning thread is the only writer, so recording
+// takes no locks and the oldest events are overwritten once a buffer is full
+class Profiler
+{
+public:
+	static constexpr uint64_t eventCapacity = 1 << 16; // per thread, a power of two
+
+	static void start();
+	static void stop();
+	static bool isRecording() { return recording.load(std::memory_order_relaxed); }
+
+	static int64_t now();
+	static void record(const char* name, int64_t start, int64_t duration);
+	// labels the calling thread in the exported trace
+	static void setThreadName(const std::string& name);
+
+	// writes every buffered event as Chrome trace JSON (chrome://tracing, ui.perfetto.dev), call after stop()
+	static bool writeChromeTrace(const std::string& path);
+
+private:
+	static std::atomic<bool> recording;
+};
+
+class ProfileScope
+{
+public:
+	explicit ProfileScope(const char* name) : name(name), start(Profiler::isRecording() ? Profiler::now() : -1) {}
+
+	~ProfileScope()
+	{
+		if (start >= 0)
+			Profiler::record(name, start, Profiler::now() - start);
+	}
+
+	ProfileScope(const ProfileScope&) = delete;
+	const ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	const char* name;
+	int64_t start;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+
+#include "RayPacket.h"
+#include "Vector3.h"
+
+// up to RayPacket::size rays of a RayQueue traced together by the wavefront stages; unlike a RayPacket every lane has
+// its own origin, and a lane with a negative closest distance is inactive (past the end of the run, or occluded)
+class QueuePacket
+{
+public:
+	static constexpr int size = RayPacket::size;
+
+	float originX[size];
+	float originY[size];
+	float originZ[size];
+	float directionX[size];
+	float directionY[size];
+	float directionZ[size];
+	float inverseX[size];
+	float inverseY[size];
+	float inverseZ[size];
+	float closest[size]; // nearest hit distance per ray, shadow rays: distance to the light, negative once occluded
+	int slots[size]; // geometry slot of the nearest hit per ray, -1 for none
+
+	void setRay(int lane, const Vector3& origin, const Vector3& direction, float maxDistance)
+	{
+		originX[lane] = origin.x;
+		originY[lane] = origin.y;
+		originZ[lane] = origin.z;
+		directionX[lane] = direction.x;
+		directionY[lane] = direction.y;
+		directionZ[lane] = direction.z;
+		inverseX[lane] = 1.0f / direction.x;
+		inverseY[lane] = 1.0f / direction.y;
+		inverseZ[lane] = 1.0f / direction.z;
+		closest[lane] = maxDistance;
+		slots[lane] = -1;
+	}
+
+	// fills the lanes from count on with inactive copies of the last ray, so the kernels can load whole vectors
+	void deactivateFrom(int count)
+	{
+		for (int lane = count; lane < size; lane++)
+		{
+			setRay(lane, { originX[count - 1], originY[count - 1], originZ[count - 1] },
+				{ directionX[count - 1], directionY[count - 1], directionZ[count - 1] }, -1.0f);
+		}
+	}
+
+	bool isActive(int lane) const
+	{
+		return closest[lane] >= 0;
+	}
+
+	// no node starting beyond this can hold a nearer hit for any ray of the packet
+	float getFarthestClosest() const
+	{
+		return *std::max_element(closest, closest + size);
+	}
+};
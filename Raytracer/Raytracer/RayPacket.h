@@ -0,0 +1,46 @@
+#pragma once
+
+#include <algorithm>
+
+#include "Vector3.h"
+
+// square block of primary rays sharing the camera origin, stored as structure of arrays so the packet kernels test
+// one vector of rays at a time against a box or a sphere
+class RayPacket
+{
+public:
+	static constexpr int width = 4;
+	static constexpr int size = width * width;
+
+	float directionX[size];
+	float directionY[size];
+	float directionZ[size];
+	float inverseX[size];
+	float inverseY[size];
+	float inverseZ[size];
+	float closest[size]; // nearest hit distance per ray, initialized to the far distance
+	int slots[size]; // geometry slot of the nearest hit per ray, -1 for none
+
+	void setRay(int lane, const Vector3& direction, float maxDistance)
+	{
+		directionX[lane] = direction.x;
+		directionY[lane] = direction.y;
+		directionZ[lane] = direction.z;
+		inverseX[lane] = 1.0f / direction.x;
+		inverseY[lane] = 1.0f / direction.y;
+		inverseZ[lane] = 1.0f / direction.z;
+		closest[lane] = maxDistance;
+		slots[lane] = -1;
+	}
+
+	Vector3 getDirection(int lane) const
+	{
+		return { directionX[lane], directionY[lane], directionZ[lane] };
+	}
+
+	// no node starting beyond this can hold a nearer hit for any ray of the packet
+	float getFarthestClosest() const
+	{
+		return *std::max_element(closest, closest + size);
+	}
+};
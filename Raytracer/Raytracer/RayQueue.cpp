@@ -0,0 +1,11 @@
+#include "RayQueue.h"
+
+void RayQueue::reserve(int capacity)
+{
+	if (static_cast<int>(weights.size()) >= capacity)
+		return;
+
+	for (std::vector<float>* array : { &originX, &originY, &originZ, &directionX, &directionY, &directionZ, &maxDistances, &weights })
+		array->resize(capacity);
+	sources.resize(capacity);
+}
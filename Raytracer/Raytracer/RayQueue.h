@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+
+#include "Vector3.h"
+
+// structure-of-arrays ray buffer of the wavefront renderer; each stage runs over a whole queue before the next starts
+class RayQueue
+{
+public:
+	std::vector<float> originX;
+	std::vector<float> originY;
+	std::vector<float> originZ;
+	std::vector<float> directionX;
+	std::vector<float> directionY;
+	std::vector<float> directionZ;
+	std::vector<float> maxDistances; // shadow rays: distance to the light
+	std::vector<float> weights; // share of the pixel color, shadow rays: light intensity if the light is not occluded
+	std::vector<int> sources; // pixel index, shadow rays: index of the ray whose hit they light
+	int count = 0;
+
+	// grows the arrays to hold at least capacity rays, never shrinks them
+	void reserve(int capacity);
+
+	void set(int index, const Vector3& origin, const Vector3& direction, float maxDistance, float weight, int source)
+	{
+		originX[index] = origin.x;
+		originY[index] = origin.y;
+		originZ[index] = origin.z;
+		directionX[index] = direction.x;
+		directionY[index] = direction.y;
+		directionZ[index] = direction.z;
+		maxDistances[index] = maxDistance;
+		weights[index] = weight;
+		sources[index] = source;
+	}
+
+	// copies the ray at index from in other to index to
+	void copy(int to, const RayQueue& other, int from)
+	{
+		set(to, other.getOrigin(from), other.getDirection(from), other.maxDistances[from], other.weights[from], other.sources[from]);
+	}
+
+	Vector3 getOrigin(int index) const
+	{
+		return { originX[index], originY[index], originZ[index] };
+	}
+
+	Vector3 getDirection(int index) const
+	{
+		return { directionX[index], directionY[index], directionZ[index] };
+	}
+};
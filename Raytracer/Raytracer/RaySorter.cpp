@@ -0,0 +1,119 @@
+#include "RaySorter.h"
+
+#include <algorithm>
+
+namespace
+{
+	constexpr int radixBits = 10;
+	constexpr int radixSize = 1 << radixBits;
+	constexpr int keyBits = 3 + 3 * RaySorter::cellBits; // octant above the Morton code
+	constexpr int chunkSize = 1 << 14; // rays per task of a pass, each with its own histogram
+
+	int getDigit(uint32_t key, int shift)
+	{
+		return static_cast<int>(key >> shift & (radixSize - 1));
+	}
+
+	// spreads the low 10 bits of value so two zero bits follow each one
+	uint32_t spreadBits(uint32_t value)
+	{
+		value = (value | value << 16) & 0x030000FFu;
+		value = (value | value << 8) & 0x0300F00Fu;
+		value = (value | value << 4) & 0x030C30C3u;
+		value = (value | value << 2) & 0x09249249u;
+		return value;
+	}
+
+	uint32_t toCell(float position, float cellOrigin, float cellScale)
+	{
+		constexpr float maxCell = (1 << RaySorter::cellBits) - 1;
+		return static_cast<uint32_t>(std::clamp((position - cellOrigin) * cellScale, 0.0f, maxCell));
+	}
+}
+
+void RaySorter::setBounds(const Vector3& boundsMin, const Vector3& boundsMax)
+{
+	const float cells = static_cast<float>(1 << cellBits);
+	const Vector3 extent = boundsMax - boundsMin;
+	cellOrigin = boundsMin;
+	cellScale = { extent.x > 0 ? cells / extent.x : 0, extent.y > 0 ? cells / extent.y : 0, extent.z > 0 ? cells / extent.z : 0 };
+}
+
+void RaySorter::resize(int count)
+{
+	keys.resize(count);
+	indices.resize(count);
+}
+
+void RaySorter::setRay(int index, const Vector3& origin, const Vector3& direction)
+{
+	const uint32_t octant = (direction.x < 0 ? 1u : 0u) | (direction.y < 0 ? 2u : 0u) | (direction.z < 0 ? 4u : 0u);
+	const uint32_t morton = spreadBits(toCell(origin.x, cellOrigin.x, cellScale.x))
+		| spreadBits(toCell(origin.y, cellOrigin.y, cellScale.y)) << 1
+		| spreadBits(toCell(origin.z, cellOrigin.z, cellScale.z)) << 2;
+	keys[index] = octant << (3 * cellBits) | morton;
+}
+
+const std::vector<int>& RaySorter::sort(ThreadPool& threadPool)
+{
+	// least significant digit radix sort; every pass counts the digits of each chunk in parallel, turns the counts into
+	// per-chunk output offsets, which keeps the sort stable, and scatters the chunks in parallel. The first pass reads
+	// the rays in queue order and drops the skipped ones, so the later passes only move the rays that are left
+	const int rayCount = static_cast<int>(keys.size());
+	scratchKeys.resize(rayCount);
+	scratchIndices.resize(rayCount);
+	histograms.resize(static_cast<size_t>(std::max(1, (rayCount + chunkSize - 1) / chunkSize)) * radixSize);
+
+	int count = rayCount;
+	for (int shift = 0; shift < keyBits; shift += radixBits)
+	{
+		const bool firstPass = shift == 0;
+		const int chunkCount = (count + chunkSize - 1) / chunkSize;
+		threadPool.parallelFor(0, chunkCount, 1, [this, shift, count](int chunk)
+		{
+			int* histogram = &histograms[static_cast<size_t>(chunk) * radixSize];
+			std::fill(histogram, histogram + radixSize, 0);
+			const int end = std::min(count, (chunk + 1) * chunkSize);
+			for (int i = chunk * chunkSize; i < end; i++)
+			{
+				if (keys[i] != skippedKey)
+					histogram[getDigit(keys[i], shift)]++;
+			}
+		});
+
+		int offset = 0;
+		for (int digit = 0; digit < radixSize; digit++)
+		{
+			for (int chunk = 0; chunk < chunkCount; chunk++)
+			{
+				int& entry = histograms[static_cast<size_t>(chunk) * radixSize + digit];
+				const int digitCount = entry;
+				entry = offset;
+				offset += digitCount;
+			}
+		}
+
+		threadPool.parallelFor(0, chunkCount, 1, [this, shift, count, firstPass](int chunk)
+		{
+			int* histogram = &histograms[static_cast<size_t>(chunk) * radixSize];
+			const int end = std::min(count, (chunk + 1) * chunkSize);
+			for (int i = chunk * chunkSize; i < end; i++)
+			{
+				if (keys[i] == skippedKey)
+					continue;
+
+				const int target = histogram[getDigit(keys[i], shift)]++;
+				scratchKeys[target] = keys[i];
+				scratchIndices[target] = firstPass ? i : indices[i];
+			}
+		});
+
+		count = offset;
+		keys.swap(scratchKeys);
+		indices.swap(scratchIndices);
+	}
+
+	keys.resize(count);
+	indices.resize(count);
+	return indices;
+}
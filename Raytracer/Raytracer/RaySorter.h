@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ThreadPool.h"
+#include "Vector3.h"
+
+// orders rays for coherent tracing: by direction octant first, then along a Morton curve through the scene bounds by
+// origin, so consecutive rays start near each other, head the same way and walk the same BVH nodes
+class RaySorter
+{
+public:
+	static constexpr int cellBits = 9; // Morton cells per axis are 1 << cellBits
+
+	// rays starting outside the bounds are clamped to the nearest cell
+	void setBounds(const Vector3& boundsMin, const Vector3& boundsMax);
+	// makes room for count rays with indices [0, count); setRay and skipRay may then run concurrently on distinct indices
+	void resize(int count);
+	void setRay(int index, const Vector3& origin, const Vector3& direction);
+	// leaves a ray out of the order
+	void skipRay(int index) { keys[index] = skippedKey; }
+	// indices of the rays that were not skipped, in sorted order; the passes run on the pool
+	const std::vector<int>& sort(ThreadPool& threadPool);
+
+private:
+	static constexpr uint32_t skippedKey = ~0u;
+
+	Vector3 cellOrigin = { 0, 0, 0 };
+	Vector3 cellScale = { 0, 0, 0 }; // world to cell coordinates
+	std::vector<uint32_t> keys;
+	std::vector<int> indices;
+	std::vector<uint32_t> scratchKeys;
+	std::vector<int> scratchIndices;
+	std::vector<int> histograms; // digit counts, then output offsets, of every chunk of a pass
+};
@@ -0,0 +1,65 @@
+#include "RayStats.h"
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+	class alignas(64) ThreadCounters
+	{
+	public:
+		RayCounters counters;
+	};
+
+	std::mutex registryMutex;
+	std::vector<std::unique_ptr<ThreadCounters>> registry;
+}
+
+void RayCounters::add(const RayCounters& other)
+{
+	primaryRays += other.primaryRays;
+	shadowRays += other.shadowRays;
+	reflectionRays += other.reflectionRays;
+	intersectionTests += other.intersectionTests;
+	nodesVisited += other.nodesVisited;
+	for (int i = 0; i < depthBuckets; i++)
+		depthHistogram[i] += other.depthHistogram[i];
+}
+
+RayCounters RayStats::collect()
+{
+	RayCounters total;
+	std::unique_lock<std::mutex> lock(registryMutex);
+	for (const auto& slot : registry)
+	{
+		total.add(slot->counters);
+		slot->counters = RayCounters();
+	}
+
+	return total;
+}
+
+std::string RayStats::format(const RayCounters& counters, double frameMilliseconds)
+{
+	const uint64_t totalRays = counters.getTotalRays();
+	const double raysPerSecond = frameMilliseconds > 0 ? totalRays / (frameMilliseconds * 1e-3) : 0;
+	const double perRay = totalRays > 0 ? 1.0 / totalRays : 0;
+
+	char buffer[256];
+	std::snprintf(buffer, sizeof(buffer), "%.2f ms | %.2f Mrays/s | primary %llu shadow %llu reflection %llu | %.1f tests/ray %.1f nodes/ray",
+		frameMilliseconds, raysPerSecond * 1e-6,
+		static_cast<unsigned long long>(counters.primaryRays), static_cast<unsigned long long>(counters.shadowRays),
+		static_cast<unsigned long long>(counters.reflectionRays),
+		counters.intersectionTests * perRay, counters.nodesVisited * perRay);
+	return buffer;
+}
+
+RayCounters* RayStats::registerThread()
+{
+	// slots outlive their threads so counts from finished workers are still collected
+	std::unique_lock<std::mutex> lock(registryMutex);
+	registry.push_back(std::make_unique<ThreadCounters>());
+	return &registry.back()->counters;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// ray counters are compiled in unless the build sets RAYTRACER_ENABLE_STATS=0
+#ifndef RAYTRACER_ENABLE_STATS
+#define RAYTRACER_ENABLE_STATS 1
+#endif
+
+#if RAYTRACER_ENABLE_STATS
+#define RAYTRACER_COUNT(field, amount) (RayStats::local().field += (amount))
+#else
+#define RAYTRACER_COUNT(field, amount) ((void)0)
+#endif
+
+class RayCounters
+{
+public:
+	static constexpr int depthBuckets = 8;
+
+	uint64_t primaryRays = 0;
+	uint64_t shadowRays = 0;
+	uint64_t reflectionRays = 0;
+	uint64_t intersectionTests = 0; // ray-sphere tests, a SIMD batch counts every sphere in it
+	uint64_t nodesVisited = 0; // BVH nodes popped by closest-hit and any-hit traversals
+	uint64_t depthHistogram[depthBuckets] = {}; // traced rays by bounce depth, 0 = primary
+
+	uint64_t getTotalRays() const { return primaryRays + shadowRays + reflectionRays; }
+	void add(const RayCounters& other);
+};
+
+// per-thread counters: every thread increments its own cache-line-aligned slot with plain adds,
+// collect() folds all of them together once per frame after the workers are done
+class RayStats
+{
+public:
+	static RayCounters& local()
+	{
+		thread_local RayCounters* counters = registerThread();
+		return *counters;
+	}
+
+	// sums and clears every thread's counters, only call while no frame is being traced
+	static RayCounters collect();
+	// one-line summary for the window title and the console: throughput, rays by type and work per ray
+	static std::string format(const RayCounters& counters, double frameMilliseconds);
+
+private:
+	static RayCounters* registerThread();
+};
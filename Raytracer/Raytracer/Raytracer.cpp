@@ -1,81 +1,1101 @@
 #include "Raytracer.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <numbers>
 
-Raytracer::Raytracer(Camera& camera, float minDistance, float maxDistance, float aspectRatio, float fov): camera(camera), minDistance(minDistance), maxDistance(maxDistance), aspectRatio(aspectRatio), fov(fov), threadPool(std::thread::hardware_concurrency())
+#include "Profiler.h"
+
+Raytracer::Raytracer(Camera& camera, float minDistance, float maxDistance, float aspectRatio, float fov): camera(camera), minDistance(minDistance), maxDistance(maxDistance), aspectRatio(aspectRatio), fov(fov), threadPool(std::thread::hardware_concurrency()), tileScheduler(defaultTileSize)
 {
-	halfFovTan = tan(fov * 0.5 * M_PI / 180.0);
+	halfFovTan = tan(fov * 0.5 * std::numbers::pi / 180.0);
+
+	constexpr Material red = { { 255, 0, 0, 0 }, 0.2f, 2, 0.2f };
+	constexpr Material green = { { 0, 255, 0, 0 }, 0.5f, 50, 0.4f };
+	constexpr Material blue = { { 0, 0, 255, 0 }, 1.f, 500, 0.7f };
+	setMaterials({ red, green, blue });
 
-	constexpr Sphere sphere1 = { { 1.f, -1, 5 }, 0.5f, { 255, 0, 0, 0 }, 0.2f, 2, 0.2f };
-	constexpr Sphere sphere2 = { { 1.5f, 0, 4 }, 0.5f, { 0, 255, 0, 0 }, 0.5f, 50, 0.4f };
-	constexpr Sphere sphere3 = { { -1.5f, 0, 4 }, 0.5f, { 0, 0, 255, 0 }, 1.f, 500, 0.7f };
-	spheres = { sphere1, sphere2, sphere3 };
+	constexpr Sphere sphere1 = { { 1.f, -1, 5 }, 0.5f, 0 };
+	constexpr Sphere sphere2 = { { 1.5f, 0, 4 }, 0.5f, 1 };
+	constexpr Sphere sphere3 = { { -1.5f, 0, 4 }, 0.5f, 2 };
+	setSpheres({ sphere1, sphere2, sphere3 });
 
 	constexpr PointLight light = { { 2, 1, 0 }, { 255, 255, 255, 0 }, 0.5f };
 	pointLights = { light };
 
-	constexpr DirectionalLight dirLight = { { 1, 1, 1 }, { 255, 255, 255, 0 }, 0.3f };
+	DirectionalLight dirLight = { { 1, 1, 1 }, { 255, 255, 255, 0 }, 0.3f };
+	dirLight.direction.normalize(); // normalized once here, the tracing threads only read it
 	directionalLights = { dirLight };
 
 	constexpr AmbientLight ambient = { { 255, 255, 255, 0 }, 0.3f };
 	ambientLights = { ambient };
 }
 
-Uint32* Raytracer::getPixel(const SDL_Surface* surface, int x, int y)
+void Raytracer::setSpheres(const std::vector<Sphere>& newSpheres)
+{
+	spheres = newSpheres;
+	sceneVersion++;
+	bvh.build(spheres, SphereGeometry::simdWidth);
+	geometry.build(spheres, bvh.primitiveIndices);
+}
+
+void Raytracer::setMaterials(const std::vector<Material>& newMaterials)
+{
+	materials = newMaterials;
+	sceneVersion++;
+}
+
+void Raytracer::setTileSize(int tileSize)
+{
+	tileScheduler.setTileSize(tileSize);
+}
+
+void Raytracer::setProgressive(bool enabled)
+{
+	progressive = enabled;
+	progressiveValid = false;
+}
+
+void Raytracer::render(const Framebuffer& framebuffer)
+{
+	frameCamera = camera;
+	frameStartTime = std::chrono::steady_clock::now();
+	renderFrame(framebuffer);
+	frameMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStartTime).count();
+	frameSamples = accumulatedSamples;
+	frameStats = RayStats::collect();
+}
+
+void Raytracer::beginRender(const Framebuffer& framebuffer)
+{
+	frameCamera = camera;
+	pendingFramebuffer = framebuffer;
+	frameStartTime = std::chrono::steady_clock::now();
+	frameTask = { [](void* context)
+	{
+		Raytracer* raytracer = static_cast<Raytracer*>(context);
+		raytracer->renderFrame(raytracer->pendingFramebuffer);
+		raytracer->renderMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - raytracer->frameStartTime).count();
+	}, this, &frameGroup };
+	threadPool.spawn(frameTask);
+}
+
+void Raytracer::endRender()
+{
+	threadPool.wait(frameGroup);
+	frameMilliseconds = renderMilliseconds;
+	frameSamples = accumulatedSamples;
+	frameStats = RayStats::collect();
+}
+
+void Raytracer::renderFrame(const Framebuffer& framebuffer)
+{
+	if (renderMode == RenderMode::Shaded)
+	{
+		if (progressive)
+		{
+			history.invalidate();
+			renderProgressive(framebuffer);
+		}
+		else
+			renderProjection(framebuffer);
+		return;
+	}
+
+	progressiveValid = false;
+	history.invalidate();
+
+	measurePixelCosts(framebuffer.width, framebuffer.height, renderMode);
+
+	const float scale = computeHeatmapScale(renderMode);
+	threadPool.parallelFor(0, framebuffer.height, 16, [this, &framebuffer, scale](int y)
+	{
+		for (int x = 0; x < framebuffer.width; x++)
+			framebuffer.setPixel(x, y, heatmapColor(pixelCosts[static_cast<size_t>(y) * framebuffer.width + x] * scale));
+	});
+}
+
+void Raytracer::renderImage(Image& image, int samplesPerPixel)
+{
+	frameCamera = camera;
+	tileScheduler.beginFrame(image.width, image.height);
+	threadPool.parallelFor(0, tileScheduler.getTileCount(), 1, [this, &image, samplesPerPixel](int tileIndex)
+	{
+		PROFILE_SCOPE("tile");
+		renderImageTile(image, tileScheduler.getTile(tileIndex), samplesPerPixel);
+	});
+	frameStats = RayStats::collect();
+}
+
+void Raytracer::renderHeatmap(Image& image, RenderMode metric)
+{
+	frameCamera = camera;
+	measurePixelCosts(image.width, image.height, metric);
+	frameStats = RayStats::collect();
+
+	const float scale = computeHeatmapScale(metric);
+	for (int y = 0; y < image.height; y++)
+	{
+		for (int x = 0; x < image.width; x++)
+		{
+			const Color color = heatmapColor(pixelCosts[static_cast<size_t>(y) * image.width + x] * scale);
+			float* pixel = image.getPixel(x, y);
+			pixel[0] = color.r / 255.0f;
+			pixel[1] = color.g / 255.0f;
+			pixel[2] = color.b / 255.0f;
+		}
+	}
+}
+
+void Raytracer::measurePixelCosts(int width, int height, RenderMode metric)
+{
+	pixelCosts.resize(static_cast<size_t>(width) * height);
+	tileScheduler.beginFrame(width, height);
+	threadPool.parallelFor(0, tileScheduler.getTileCount(), 1, [this, width, height, metric](int tileIndex)
+	{
+		PROFILE_SCOPE("tile");
+		measureTileCosts(tileScheduler.getTile(tileIndex), width, height, metric);
+	});
+}
+
+void Raytracer::measureTileCosts(const Tile& tile, int width, int height, RenderMode metric)
+{
+	using Clock = std::chrono::steady_clock;
+	const RayCounters& counters = RayStats::local();
+
+	for (int y = tile.y0; y < tile.y1; y++)
+	{
+		for (int x = tile.x0; x < tile.x1; x++)
+		{
+			const Clock::time_point start = Clock::now();
+			const uint64_t raysBefore = counters.getTotalRays();
+
+			const Vector3 rayDirection = computePrimaryRayDirection(x + 0.5f, y + 0.5f, width, height);
+			traceRay(frameCamera.position, rayDirection, recursionLimit);
+
+			float& cost = pixelCosts[static_cast<size_t>(y) * width + x];
+			if (metric == RenderMode::TimeHeatmap)
+				cost = std::chrono::duration<float, std::nano>(Clock::now() - start).count();
+			else
+				cost = static_cast<float>(counters.getTotalRays() - raysBefore);
+		}
+	}
+}
+
+float Raytracer::computeHeatmapScale(RenderMode metric)
+{
+	if (pixelCosts.empty())
+		return 0;
+
+	if (metric == RenderMode::RayHeatmap)
+	{
+		const float maxRays = *std::max_element(pixelCosts.begin(), pixelCosts.end());
+		return maxRays > 0 ? 1.0f / maxRays : 0;
+	}
+
+	// normalize times to the 99th percentile so a few preempted pixels do not flatten the whole map
+	sortedCosts = pixelCosts;
+	const auto percentile = sortedCosts.begin() + (sortedCosts.size() - 1) * 99 / 100;
+	std::nth_element(sortedCosts.begin(), percentile, sortedCosts.end());
+	return *percentile > 0 ? 1.0f / *percentile : 0;
+}
+
+void Raytracer::renderProjection(const Framebuffer& framebuffer)
+{
+	tileScheduler.beginFrame(framebuffer.width, framebuffer.height);
+
+	if (temporalReuse)
+	{
+		// the shadow tests of more lights do not fit into a TemporalSample
+		const int lightCount = static_cast<int>(directionalLights.size() + pointLights.size());
+		const bool reuse = history.beginFrame(framebuffer.width, framebuffer.height, sceneVersion) && lightCount <= TemporalHistory::maxLights;
+		if (reuse)
+		{
+			PROFILE_SCOPE("reproject");
+			history.reproject(frameCamera, aspectRatio, halfFovTan, threadPool);
+		}
+
+		threadPool.parallelFor(0, tileScheduler.getTileCount(), 1, [this, &framebuffer, reuse](int tileIndex)
+		{
+			PROFILE_SCOPE("tile");
+			renderTemporalTile(framebuffer, tileScheduler.getTile(tileIndex), reuse);
+		});
+		history.endFrame(sceneVersion);
+		return;
+	}
+
+	history.invalidate();
+	if (wavefront && !adaptive)
+	{
+		renderWavefront(framebuffer);
+		return;
+	}
+
+	threadPool.parallelFor(0, tileScheduler.getTileCount(), 1, [this, &framebuffer](int tileIndex)
+	{
+		PROFILE_SCOPE("tile");
+		if (adaptive)
+			renderAdaptiveTile(framebuffer, tileScheduler.getTile(tileIndex));
+		else if (packetTracing)
+			renderPacketTile(framebuffer, tileScheduler.getTile(tileIndex));
+		else
+			renderTile(framebuffer, tileScheduler.getTile(tileIndex));
+	});
+}
+
+template<typename F>
+void Raytracer::writeTile(const Framebuffer& framebuffer, const Tile& tile, F&& shadePixel)
+{
+	// rows are shaded into a small buffer and tone mapped into the framebuffer a span at a time
+	constexpr int spanCapacity = 64;
+	FloatColor span[spanCapacity];
+
+	for (int y = tile.y0; y < tile.y1; y++)
+	{
+		for (int spanX = tile.x0; spanX < tile.x1; spanX += spanCapacity)
+		{
+			const int count = std::min(spanCapacity, tile.x1 - spanX);
+			for (int i = 0; i < count; i++)
+				span[i] = shadePixel(spanX + i, y);
+
+			framebuffer.setSpan(spanX, y, span, count, toneMapper);
+		}
+	}
+}
+
+void Raytracer::renderTile(const Framebuffer& framebuffer, const Tile& tile)
+{
+	writeTile(framebuffer, tile, [this, &framebuffer](int x, int y)
+	{
+		const Vector3 rayDirection = computePrimaryRayDirection(x + 0.5f, y + 0.5f, framebuffer.width, framebuffer.height);
+		return traceRay(frameCamera.position, rayDirection, recursionLimit);
+	});
+}
+
+void Raytracer::renderWavefront(const Framebuffer& framebuffer)
+{
+	const int pixelCount = framebuffer.width * framebuffer.height;
+	const int lightCount = static_cast<int>(directionalLights.size() + pointLights.size());
+	const int batchSize = std::min(wavefrontBatchSize, pixelCount);
+	rayQueue.reserve(batchSize);
+	reflectionQueue.reserve(batchSize);
+	shadowQueue.reserve(batchSize * lightCount);
+	hitPrimitives.resize(batchSize);
+	hitDistances.resize(batchSize);
+	hitReflects.resize(batchSize);
+	wavefrontColors.assign(pixelCount, { 0, 0, 0, 0 });
+	if (!bvh.empty())
+		raySorter.setBounds(bvh.nodes[0].boundsMin, bvh.nodes[0].boundsMax);
+
+	for (int batchBegin = 0; batchBegin < pixelCount; batchBegin += batchSize)
+	{
+		rayQueue.count = std::min(batchSize, pixelCount - batchBegin);
+		{
+			PROFILE_SCOPE("generate");
+			threadPool.parallelFor(0, rayQueue.count, wavefrontGrain, [this, &framebuffer, batchBegin](int i)
+			{
+				const int pixel = batchBegin + i;
+				const int x = pixel % framebuffer.width;
+				const int y = pixel / framebuffer.width;
+				const Vector3 rayDirection = computePrimaryRayDirection(x + 0.5f, y + 0.5f, framebuffer.width, framebuffer.height);
+				rayQueue.set(i, frameCamera.position, rayDirection, maxDistance, 1.0f, pixel);
+			});
+		}
+
+		for (int bounce = 0; rayQueue.count > 0; bounce++)
+		{
+			intersectRayQueue(bounce);
+			shadeRayQueue(bounce);
+			traceShadowQueue();
+			resolveRayQueue();
+			compactReflectionQueue();
+		}
+	}
+
+	PROFILE_SCOPE("pack");
+	threadPool.parallelFor(0, framebuffer.height, 16, [this, &framebuffer](int y)
+	{
+		framebuffer.setSpan(0, y, &wavefrontColors[static_cast<size_t>(y) * framebuffer.width], framebuffer.width, toneMapper);
+	});
+}
+
+void Raytracer::intersectRayQueue(int bounce)
+{
+	PROFILE_SCOPE("intersect");
+	if (bounce == 0 && packetTracing)
+	{
+		// primary rays share the camera origin, so runs of RayPacket::size neighbors of a row are traced as one packet;
+		// the lanes past the end of the queue repeat its last ray
+		const int packetCount = (rayQueue.count + RayPacket::size - 1) / RayPacket::size;
+		threadPool.parallelFor(0, packetCount, wavefrontGrain / RayPacket::size, [this](int packetIndex)
+		{
+			const int first = packetIndex * RayPacket::size;
+			const int count = std::min(RayPacket::size, rayQueue.count - first);
+			RAYTRACER_COUNT(primaryRays, count);
+			RAYTRACER_COUNT(depthHistogram[0], count);
+
+			RayPacket packet;
+			for (int lane = 0; lane < RayPacket::size; lane++)
+				packet.setRay(lane, rayQueue.getDirection(first + std::min(lane, count - 1)), maxDistance);
+
+			findPacketIntersections(packet);
+			for (int lane = 0; lane < count; lane++)
+			{
+				const int slot = packet.slots[lane];
+				hitPrimitives[first + lane] = slot >= 0 ? bvh.primitiveIndices[slot] : -1;
+				hitDistances[first + lane] = packet.closest[lane];
+			}
+		});
+		return;
+	}
+
+	if (packetTracing && raySorting)
+	{
+		// sorted reflection rays that are neighbors in the queue share a direction octant and a region of the scene, so
+		// runs of them are traced as packets with per-ray origins; in pixel order the reflections off curved surfaces
+		// diverge too much for a shared traversal to pay off
+		const int packetCount = (rayQueue.count + QueuePacket::size - 1) / QueuePacket::size;
+		threadPool.parallelFor(0, packetCount, wavefrontGrain / QueuePacket::size, [this, bounce](int packetIndex)
+		{
+			const int first = packetIndex * QueuePacket::size;
+			const int count = std::min(QueuePacket::size, rayQueue.count - first);
+			RAYTRACER_COUNT(reflectionRays, count);
+			RAYTRACER_COUNT(depthHistogram[std::min(bounce, RayCounters::depthBuckets - 1)], count);
+
+			QueuePacket packet;
+			for (int lane = 0; lane < count; lane++)
+				packet.setRay(lane, rayQueue.getOrigin(first + lane), rayQueue.getDirection(first + lane), maxDistance);
+			packet.deactivateFrom(count);
+
+			bvh.traversePacket(packet, [&](int leafFirst, int leafCount)
+			{
+				RAYTRACER_COUNT(intersectionTests, leafCount * count);
+				geometry.intersectPacket(packet, leafFirst, leafCount, minDistance);
+			});
+			for (int lane = 0; lane < count; lane++)
+			{
+				const int slot = packet.slots[lane];
+				hitPrimitives[first + lane] = slot >= 0 ? bvh.primitiveIndices[slot] : -1;
+				hitDistances[first + lane] = packet.closest[lane];
+			}
+		});
+		return;
+	}
+
+	threadPool.parallelFor(0, rayQueue.count, wavefrontGrain, [this, bounce](int i)
+	{
+#if RAYTRACER_ENABLE_STATS
+		RayCounters& stats = RayStats::local();
+		(bounce == 0 ? stats.primaryRays : stats.reflectionRays)++;
+		stats.depthHistogram[std::min(bounce, RayCounters::depthBuckets - 1)]++;
+#endif
+
+		HitRecord hit;
+		findClosestIntersection(rayQueue.getOrigin(i), rayQueue.getDirection(i), hit);
+		hitPrimitives[i] = hit.primitive;
+		hitDistances[i] = hit.t;
+	});
+}
+
+// the lighting of computeLightingIntensity and the reflection of traceRay, with every shadow test deferred to a queue
+void Raytracer::shadeRayQueue(int bounce)
+{
+	PROFILE_SCOPE("shade");
+	const int lightCount = static_cast<int>(directionalLights.size() + pointLights.size());
+	shadowQueue.count = rayQueue.count * lightCount;
+	threadPool.parallelFor(0, rayQueue.count, wavefrontGrain, [this, bounce, lightCount](int i)
+	{
+		const int primitive = hitPrimitives[i];
+		hitReflects[i] = 0;
+		if (primitive < 0)
+		{
+			for (int light = 0; light < lightCount; light++)
+				shadowQueue.weights[i * lightCount + light] = 0;
+			return;
+		}
+
+		const Material& material = materials[spheres[primitive].material];
+		const Vector3 origin = rayQueue.getOrigin(i);
+		const Vector3 direction = rayQueue.getDirection(i);
+		const Vector3 point = origin + direction * hitDistances[i];
+		Vector3 normal = point - spheres[primitive].center;
+		normal.normalize();
+		const Vector3 view = -frameCamera.forward;
+
+		int shadowIndex = i * lightCount;
+		for (const auto& dirLight : directionalLights)
+		{
+			const float intensity = computeBlinPhong(dirLight.direction, normal, view, dirLight.intensity, material.lambert, material.specular);
+			shadowQueue.set(shadowIndex++, point, dirLight.direction, maxDistance, intensity, i);
+		}
+
+		for (const auto& pointLight : pointLights)
+		{
+			Vector3 lightDir = pointLight.position - point;
+			const float distance = lightDir.length();
+			lightDir.x /= distance;
+			lightDir.y /= distance;
+			lightDir.z /= distance;
+			const float intensity = computeBlinPhong(lightDir, normal, view, pointLight.intensity, material.lambert, material.specular);
+			shadowQueue.set(shadowIndex++, point, lightDir, distance, intensity, i);
+		}
+
+		if (bounce < recursionLimit && !epsilonEquals(material.reflectivity, 0.0f))
+		{
+			// a reflection that is cut off still blends in as black, its queue weight of 0 keeps it out of the next bounce
+			const float weight = rayQueue.weights[i];
+			const Vector3 reflectedRay = reflectRay(direction, normal);
+			const float scale = computeReflectionScale(weight, material.reflectivity, point, reflectedRay);
+			hitReflects[i] = 1;
+			reflectionQueue.set(i, point, reflectedRay, maxDistance, weight * scale, rayQueue.sources[i]);
+		}
+	});
+}
+
+void Raytracer::traceShadowQueue()
+{
+	// lights facing away contribute nothing whether occluded or not, so their shadow rays are never traced
+	const auto trace = [this](int i)
+	{
+		if (isShadowed(shadowQueue.getOrigin(i), shadowQueue.getDirection(i), shadowQueue.maxDistances[i]))
+			shadowQueue.weights[i] = 0;
+	};
+
+	// the shadow rays at indices[0, count) as one packet, count at most QueuePacket::size
+	const auto tracePacket = [this](const int* indices, int count)
+	{
+		RAYTRACER_COUNT(shadowRays, count);
+		QueuePacket packet;
+		for (int lane = 0; lane < count; lane++)
+			packet.setRay(lane, shadowQueue.getOrigin(indices[lane]), shadowQueue.getDirection(indices[lane]), shadowQueue.maxDistances[indices[lane]]);
+		packet.deactivateFrom(count);
+
+		bvh.traversePacketAny(packet, [&](int first, int leafCount)
+		{
+			RAYTRACER_COUNT(intersectionTests, leafCount * count);
+			return geometry.occludesPacket(packet, first, leafCount, minDistance);
+		});
+		for (int lane = 0; lane < count; lane++)
+		{
+			if (!packet.isActive(lane))
+				shadowQueue.weights[indices[lane]] = 0;
+		}
+	};
+
+	if (raySorting && !bvh.empty())
+	{
+		// the results stay at their queue index, which is what resolveRayQueue reads, so only the trace order changes
+		const std::vector<int>* order;
+		{
+			PROFILE_SCOPE("sort shadow rays");
+			sortRays(shadowQueue, [this](int i) { return shadowQueue.weights[i] > 0; });
+			order = &raySorter.sort(threadPool);
+		}
+
+		PROFILE_SCOPE("shadow");
+		const int rayCount = static_cast<int>(order->size());
+		if (packetTracing)
+		{
+			// neighbors in sorted order share a direction octant and a region of the scene
+			const int packetCount = (rayCount + QueuePacket::size - 1) / QueuePacket::size;
+			threadPool.parallelFor(0, packetCount, wavefrontGrain / QueuePacket::size, [&tracePacket, order, rayCount](int packetIndex)
+			{
+				const int first = packetIndex * QueuePacket::size;
+				tracePacket(order->data() + first, std::min(QueuePacket::size, rayCount - first));
+			});
+			return;
+		}
+
+		threadPool.parallelFor(0, rayCount, wavefrontGrain, [&trace, order](int i)
+		{
+			trace((*order)[i]);
+		});
+		return;
+	}
+
+	PROFILE_SCOPE("shadow");
+	if (packetTracing)
+	{
+		// a packet takes the rays of one light from a run of QueuePacket::size neighboring hits, skipping the lights
+		// that face away
+		const int lightCount = static_cast<int>(directionalLights.size() + pointLights.size());
+		const int runCount = (rayQueue.count + QueuePacket::size - 1) / QueuePacket::size;
+		threadPool.parallelFor(0, runCount * lightCount, wavefrontGrain / QueuePacket::size, [this, &tracePacket, lightCount](int packetIndex)
+		{
+			const int light = packetIndex % lightCount;
+			const int first = packetIndex / lightCount * QueuePacket::size;
+			const int last = std::min(first + QueuePacket::size, rayQueue.count);
+			int indices[QueuePacket::size];
+			int count = 0;
+			for (int ray = first; ray < last; ray++)
+			{
+				const int index = ray * lightCount + light;
+				if (shadowQueue.weights[index] > 0)
+					indices[count++] = index;
+			}
+
+			if (count > 0)
+				tracePacket(indices, count);
+		});
+		return;
+	}
+
+	threadPool.parallelFor(0, shadowQueue.count, wavefrontGrain, [this, &trace](int i)
+	{
+		if (shadowQueue.weights[i] > 0)
+			trace(i);
+	});
+}
+
+template<typename F>
+void Raytracer::sortRays(const RayQueue& queue, F&& isTraced)
+{
+	raySorter.resize(queue.count);
+	threadPool.parallelFor(0, queue.count, wavefrontGrain, [this, &queue, &isTraced](int i)
+	{
+		if (isTraced(i))
+			raySorter.setRay(i, queue.getOrigin(i), queue.getDirection(i));
+		else
+			raySorter.skipRay(i);
+	});
+}
+
+void Raytracer::resolveRayQueue()
+{
+	PROFILE_SCOPE("resolve");
+	const int lightCount = static_cast<int>(directionalLights.size() + pointLights.size());
+	threadPool.parallelFor(0, rayQueue.count, wavefrontGrain, [this, lightCount](int i)
+	{
+		const int primitive = hitPrimitives[i];
+		if (primitive < 0)
+			return; // black background
+
+		// same summation order as computeLightingIntensity
+		float intensity = 0.0f;
+		for (const auto& ambient : ambientLights)
+			intensity += ambient.intensity;
+		for (int light = 0; light < lightCount; light++)
+			intensity += shadowQueue.weights[i * lightCount + light];
+
+		const Material& material = materials[spheres[primitive].material];
+		const FloatColor color = FloatColor::fromColor(material.color) * intensity;
+
+		// a ray that reflects keeps 1 - reflectivity of its weight, the rest is passed on to the reflection ray; every
+		// pixel has at most one ray per bounce, so the sums are written without synchronization
+		const float weight = rayQueue.weights[i] * (hitReflects[i] ? 1 - material.reflectivity : 1.0f);
+		wavefrontColors[rayQueue.sources[i]] += color * weight;
+	});
+}
+
+void Raytracer::compactReflectionQueue()
+{
+	PROFILE_SCOPE("compact");
+	if (raySorting && !bvh.empty())
+	{
+		// the next bounce reads its rays in sorted order, the pixel index travels with each ray
+		PROFILE_SCOPE("sort reflection rays");
+		reflectionQueue.count = rayQueue.count;
+		sortRays(reflectionQueue, [this](int i) { return hitReflects[i] && reflectionQueue.weights[i] > 0; });
+		const std::vector<int>& order = raySorter.sort(threadPool);
+		for (size_t i = 0; i < order.size(); i++)
+			rayQueue.copy(static_cast<int>(i), reflectionQueue, order[i]);
+		rayQueue.count = static_cast<int>(order.size());
+		return;
+	}
+
+	int count = 0;
+	for (int i = 0; i < rayQueue.count; i++)
+	{
+		if (hitReflects[i] && reflectionQueue.weights[i] > 0)
+			rayQueue.copy(count++, reflectionQueue, i);
+	}
+
+	rayQueue.count = count;
+}
+
+void Raytracer::renderPacketTile(const Framebuffer& framebuffer, const Tile& tile)
+{
+	// the tile is traced a packet at a time into per-thread scratch, then written like the other tiles
+	const int tileWidth = tile.x1 - tile.x0;
+	thread_local std::vector<FloatColor> tileColors;
+	tileColors.resize(static_cast<size_t>(tileWidth) * (tile.y1 - tile.y0));
+	FloatColor colors[RayPacket::size];
+	RayPacket packet;
+
+	for (int packetY = tile.y0; packetY < tile.y1; packetY += RayPacket::width)
+	{
+		const int rows = std::min(RayPacket::width, tile.y1 - packetY);
+		for (int packetX = tile.x0; packetX < tile.x1; packetX += RayPacket::width)
+		{
+			// at the tile edges the lanes outside the block repeat its nearest ray, so the kernels always see a full packet
+			const int columns = std::min(RayPacket::width, tile.x1 - packetX);
+			for (int lane = 0; lane < RayPacket::size; lane++)
+			{
+				const int row = std::min(lane / RayPacket::width, rows - 1);
+				const int column = std::min(lane % RayPacket::width, columns - 1);
+				const Vector3 rayDirection = computePrimaryRayDirection(packetX + column + 0.5f, packetY + row + 0.5f, framebuffer.width, framebuffer.height);
+				packet.setRay(lane, rayDirection, maxDistance);
+			}
+
+			tracePacket(packet, columns, rows, colors);
+			for (int row = 0; row < rows; row++)
+			{
+				for (int column = 0; column < columns; column++)
+					tileColors[static_cast<size_t>(packetY - tile.y0 + row) * tileWidth + packetX - tile.x0 + column] = colors[row * RayPacket::width + column];
+			}
+		}
+	}
+
+	writeTile(framebuffer, tile, [&](int x, int y)
+	{
+		return tileColors[static_cast<size_t>(y - tile.y0) * tileWidth + x - tile.x0];
+	});
+}
+
+void Raytracer::renderTemporalTile(const Framebuffer& framebuffer, const Tile& tile, bool reuse)
 {
-	return reinterpret_cast<Uint32*>(static_cast<Uint8*>(surface->pixels) + y * surface->pitch + x * 4);
+	writeTile(framebuffer, tile, [this, &framebuffer, reuse](int x, int y)
+	{
+		const Vector3& origin = frameCamera.position;
+		const Vector3 rayDirection = computePrimaryRayDirection(x + 0.5f, y + 0.5f, framebuffer.width, framebuffer.height);
+		const TemporalSample* previous = reuse ? history.findReprojected(x, y) : nullptr;
+		TemporalSample sample;
+		const auto missBackground = [&]()
+		{
+			sample.point = rayDirection;
+			history.store(x, y, sample);
+			return FloatColor{ 0, 0, 0, 0 }; // background color
+		};
+
+		// the whole neighborhood saw the background
+		if (previous && previous->primitive < 0)
+			return missBackground();
+
+		HitRecord hit;
+		bool cachedVisibility = false;
+		if (previous)
+		{
+			// the neighborhood agrees on the sphere, so only it is intersected, at this pixel's own center
+			RAYTRACER_COUNT(intersectionTests, 1);
+			hit.t = intersectRaySphere(origin, rayDirection, spheres[previous->primitive]);
+			if (hit.t > minDistance)
+			{
+				hit.primitive = previous->primitive;
+				hit.normal = origin + rayDirection * hit.t - spheres[hit.primitive].center;
+				hit.normal.normalize();
+				sample.lightVisibility = previous->lightVisibility;
+				cachedVisibility = true;
+			}
+		}
+
+		if (!cachedVisibility)
+		{
+			RAYTRACER_COUNT(primaryRays, 1);
+			RAYTRACER_COUNT(depthHistogram[0], 1);
+			if (!findClosestIntersection(origin, rayDirection, hit))
+				return missBackground();
+		}
+
+		// highlights and reflections are evaluated at the new hit, only the shadow tests may come from the previous frame
+		sample.primitive = hit.primitive;
+		sample.point = origin + rayDirection * hit.t;
+		const Material& material = materials[spheres[hit.primitive].material];
+		const float intensity = accumulateLighting(sample.point, hit.normal, -frameCamera.forward, material,
+			[&](int light, const Vector3& lightDir, float distanceToLight)
+		{
+			if (cachedVisibility)
+				return (sample.lightVisibility >> light & 1) != 0;
+
+			const bool lit = !isShadowed(sample.point, lightDir, distanceToLight);
+			if (lit && light < TemporalHistory::maxLights)
+				sample.lightVisibility |= 1u << light;
+			return lit;
+		});
+		history.store(x, y, sample);
+		return shadeHit(origin, rayDirection, hit, recursionLimit, FloatColor::fromColor(material.color) * intensity);
+	});
 }
 
-void Raytracer::setPixel(const SDL_Surface* surface, int x, int y, Color color)
+namespace
 {
-	*getPixel(surface, x, y) = SDL_MapRGBA(surface->format, color.r, color.g, color.b, color.a);
+	class AdaptiveSample
+	{
+	public:
+		FloatColor color;
+		int primitive;
+		float depth;
+		bool traced;
+	};
+
+	// grid coordinates of a tile side: every step-th pixel plus the last one, so each cell is closed on both ends
+	void buildGrid(int length, int step, std::vector<int>& grid)
+	{
+		grid.clear();
+		for (int i = 0; i < length - 1; i += step)
+			grid.push_back(i);
+		grid.push_back(length - 1);
+		if (grid.size() == 1)
+			grid.push_back(length - 1); // a one pixel wide side still forms a (degenerate) cell
+	}
+
+	float lerpChannel(float a, float b, float c, float d, float u, float v)
+	{
+		return (a + (b - a) * u) * (1 - v) + (c + (d - c) * u) * v;
+	}
 }
 
-void Raytracer::render(SDL_Renderer* renderer, SDL_Surface* surface, SDL_Texture* texture)
+void Raytracer::renderAdaptiveTile(const Framebuffer& framebuffer, const Tile& tile)
 {
-	SDL_LockSurface(surface);
-	renderProjection(renderer, surface, texture);
-	SDL_UnlockSurface(surface);
-	SDL_UpdateTexture(texture, nullptr, surface->pixels, surface->pitch);
-	SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+	const int tileWidth = tile.x1 - tile.x0;
+	const int tileHeight = tile.y1 - tile.y0;
+
+	// per-thread scratch so tiles do not allocate
+	thread_local std::vector<AdaptiveSample> samples;
+	thread_local std::vector<int> gridX;
+	thread_local std::vector<int> gridY;
+	samples.assign(static_cast<size_t>(tileWidth) * tileHeight, { { 0, 0, 0, 0 }, -1, 0, false });
+	buildGrid(tileWidth, adaptiveGridStep, gridX);
+	buildGrid(tileHeight, adaptiveGridStep, gridY);
+
+	const auto trace = [&](int x, int y)
+	{
+		AdaptiveSample& sample = samples[static_cast<size_t>(y) * tileWidth + x];
+		if (sample.traced)
+			return;
+
+		HitRecord hit;
+		const Vector3 rayDirection = computePrimaryRayDirection(tile.x0 + x + 0.5f, tile.y0 + y + 0.5f, framebuffer.width, framebuffer.height);
+		sample.color = traceRay(frameCamera.position, rayDirection, recursionLimit, &hit);
+		sample.primitive = hit.primitive;
+		sample.depth = hit.t;
+		sample.traced = true;
+	};
+
+	for (const int y : gridY)
+	{
+		for (const int x : gridX)
+			trace(x, y);
+	}
+
+	const auto isSimilar = [](const AdaptiveSample& a, const AdaptiveSample& b)
+	{
+		if (a.primitive != b.primitive)
+			return false;
+		if (a.primitive >= 0 && std::abs(a.depth - b.depth) > adaptiveDepthThreshold * std::min(a.depth, b.depth))
+			return false;
+
+		return std::abs(a.color.r - b.color.r) <= adaptiveColorThreshold
+			&& std::abs(a.color.g - b.color.g) <= adaptiveColorThreshold
+			&& std::abs(a.color.b - b.color.b) <= adaptiveColorThreshold;
+	};
+
+	// cells with disagreeing corners are traced completely, including their borders, before anything is interpolated
+	// so a border pixel shared with a smooth cell keeps its traced value
+	thread_local std::vector<char> smoothCells;
+	smoothCells.assign(gridX.size() * gridY.size(), 0);
+	for (size_t cellY = 0; cellY + 1 < gridY.size(); cellY++)
+	{
+		for (size_t cellX = 0; cellX + 1 < gridX.size(); cellX++)
+		{
+			const int x0 = gridX[cellX];
+			const int x1 = gridX[cellX + 1];
+			const int y0 = gridY[cellY];
+			const int y1 = gridY[cellY + 1];
+			const AdaptiveSample& topLeft = samples[static_cast<size_t>(y0) * tileWidth + x0];
+			const AdaptiveSample& topRight = samples[static_cast<size_t>(y0) * tileWidth + x1];
+			const AdaptiveSample& bottomLeft = samples[static_cast<size_t>(y1) * tileWidth + x0];
+			const AdaptiveSample& bottomRight = samples[static_cast<size_t>(y1) * tileWidth + x1];
+			if (isSimilar(topLeft, topRight) && isSimilar(topLeft, bottomLeft) && isSimilar(topLeft, bottomRight))
+			{
+				// agreeing corners still miss a sphere that projects between them
+				const Vector3 corners[4] = {
+					computePrimaryRayDirection(tile.x0 + x0 + 0.5f, tile.y0 + y0 + 0.5f, framebuffer.width, framebuffer.height),
+					computePrimaryRayDirection(tile.x0 + x1 + 0.5f, tile.y0 + y0 + 0.5f, framebuffer.width, framebuffer.height),
+					computePrimaryRayDirection(tile.x0 + x1 + 0.5f, tile.y0 + y1 + 0.5f, framebuffer.width, framebuffer.height),
+					computePrimaryRayDirection(tile.x0 + x0 + 0.5f, tile.y0 + y1 + 0.5f, framebuffer.width, framebuffer.height) };
+				if (!mayRevealOtherPrimitive(corners, topLeft.primitive))
+				{
+					smoothCells[cellY * gridX.size() + cellX] = 1;
+					continue;
+				}
+			}
+
+			for (int y = y0; y <= y1; y++)
+			{
+				for (int x = x0; x <= x1; x++)
+					trace(x, y);
+			}
+		}
+	}
+
+	for (size_t cellY = 0; cellY + 1 < gridY.size(); cellY++)
+	{
+		for (size_t cellX = 0; cellX + 1 < gridX.size(); cellX++)
+		{
+			if (!smoothCells[cellY * gridX.size() + cellX])
+				continue;
+
+			const int x0 = gridX[cellX];
+			const int x1 = gridX[cellX + 1];
+			const int y0 = gridY[cellY];
+			const int y1 = gridY[cellY + 1];
+			const FloatColor& topLeft = samples[static_cast<size_t>(y0) * tileWidth + x0].color;
+			const FloatColor& topRight = samples[static_cast<size_t>(y0) * tileWidth + x1].color;
+			const FloatColor& bottomLeft = samples[static_cast<size_t>(y1) * tileWidth + x0].color;
+			const FloatColor& bottomRight = samples[static_cast<size_t>(y1) * tileWidth + x1].color;
+
+			for (int y = y0; y <= y1; y++)
+			{
+				const float v = y1 > y0 ? static_cast<float>(y - y0) / (y1 - y0) : 0.0f;
+				for (int x = x0; x <= x1; x++)
+				{
+					AdaptiveSample& sample = samples[static_cast<size_t>(y) * tileWidth + x];
+					if (sample.traced)
+						continue;
+
+					const float u = x1 > x0 ? static_cast<float>(x - x0) / (x1 - x0) : 0.0f;
+					sample.color = { lerpChannel(topLeft.r, topRight.r, bottomLeft.r, bottomRight.r, u, v),
+						lerpChannel(topLeft.g, topRight.g, bottomLeft.g, bottomRight.g, u, v),
+						lerpChannel(topLeft.b, topRight.b, bottomLeft.b, bottomRight.b, u, v), 0 };
+				}
+			}
+		}
+	}
+
+	writeTile(framebuffer, tile, [&](int x, int y)
+	{
+		return samples[static_cast<size_t>(y - tile.y0) * tileWidth + x - tile.x0].color;
+	});
 }
 
-void Raytracer::renderProjection(SDL_Renderer* renderer, SDL_Surface* surface, SDL_Texture* texture)
+bool Raytracer::mayRevealOtherPrimitive(const Vector3 (&corners)[4], int primitive) const
 {
-	std::vector<std::future<void>> futures;
-	for (int y = 0; y < surface->h; y++)
+	// the primary rays through the cell lie in the cone spanned by the corner rays; the planes of its sides point
+	// inwards, and a degenerate side of a one pixel wide cell gives a zero normal that excludes nothing
+	const Vector3 center = corners[0] + corners[1] + corners[2] + corners[3];
+	Vector3 normals[4];
+	for (int i = 0; i < 4; i++)
 	{
-		auto future = threadPool.enqueue([this, y, surface]
+		normals[i] = corners[i].cross(corners[(i + 1) % 4]);
+		const float length = normals[i].length();
+		if (length > 0)
+			normals[i] = normals[i] * ((normals[i] * center < 0 ? -1.0f : 1.0f) / length);
+	}
+
+	// a sphere is convex, so if all corners hit it every ray of the cone does, no farther than its far side; only
+	// spheres starting closer than that can cover it
+	const Vector3& origin = frameCamera.position;
+	float maxVisibleDistance = maxDistance;
+	if (primitive >= 0)
+		maxVisibleDistance = (spheres[primitive].center - origin).length() + spheres[primitive].radius;
+
+	return bvh.traverseFrustum(origin, normals, maxVisibleDistance, [&](int first, int count)
+	{
+		for (int slot = first; slot < first + count; slot++)
 		{
-			const Vector3 forward = camera.forward;
-			const Vector3 right = camera.right;
-			const Vector3 up = camera.up;
+			const int index = bvh.primitiveIndices[slot];
+			if (index == primitive)
+				continue;
+
+			const Sphere& sphere = spheres[index];
+			const Vector3 offset = sphere.center - origin;
+			if (offset.length() - sphere.radius >= maxVisibleDistance)
+				continue;
 
-			for (int x = 0; x < surface->w; x++)
+			bool inside = true;
+			for (const Vector3& normal : normals)
+				inside = inside && normal * offset >= -sphere.radius;
+
+			if (inside)
+				return true;
+		}
+
+		return false;
+	});
+}
+
+void Raytracer::renderImageTile(Image& image, const Tile& tile, int samplesPerPixel)
+{
+	const float sampleWeight = 1.0f / samplesPerPixel;
+
+	for (int y = tile.y0; y < tile.y1; y++)
+	{
+		for (int x = tile.x0; x < tile.x1; x++)
+		{
+			FloatColor sum = { 0, 0, 0, 0 };
+			for (int sample = 0; sample < samplesPerPixel; sample++)
 			{
-				// calculate NDC coordinates and adjust for aspect ratio
-				float ndcX = (x + 0.5f) / surface->w * 2.0f - 1.0f;
-				float ndcY = 1.0f - (y + 0.5f) / surface->h * 2.0f; // flip y so +y is up
-				ndcX *= aspectRatio * halfFovTan;
-				ndcY *= halfFovTan;
-
-				Vector3 rayDirection = forward + (right * ndcX) + (up * ndcY);
-				rayDirection.normalize();
-				const Color color = traceRay(camera.position, rayDirection, recursionLimit);
-				setPixel(surface, x, y, color);
+				float offsetX;
+				float offsetY;
+				computeSampleOffset(sample, samplesPerPixel, offsetX, offsetY);
+
+				const Vector3 rayDirection = computePrimaryRayDirection(x + offsetX, y + offsetY, image.width, image.height);
+				sum += traceRay(frameCamera.position, rayDirection, recursionLimit);
 			}
+
+			float* pixel = image.getPixel(x, y);
+			pixel[0] = sum.r * sampleWeight;
+			pixel[1] = sum.g * sampleWeight;
+			pixel[2] = sum.b * sampleWeight;
+		}
+	}
+}
+
+namespace
+{
+	bool isSameView(const Camera& a, const Camera& b)
+	{
+		const auto equal = [](const Vector3& u, const Vector3& v) { return u.x == v.x && u.y == v.y && u.z == v.z; };
+		return equal(a.position, b.position) && equal(a.forward, b.forward) && equal(a.up, b.up) && equal(a.right, b.right);
+	}
+}
+
+void Raytracer::renderProgressive(const Framebuffer& framebuffer)
+{
+	const int width = framebuffer.width;
+	const int height = framebuffer.height;
+	if (!progressiveValid || progressiveSceneVersion != sceneVersion || width != progressiveWidth || height != progressiveHeight
+		|| !isSameView(frameCamera, progressiveCamera))
+	{
+		progressiveValid = true;
+		progressiveSceneVersion = sceneVersion;
+		progressiveCamera = frameCamera;
+		progressiveWidth = width;
+		progressiveHeight = height;
+		progressiveBlock = progressiveStartBlock * 2;
+		accumulatedSamples = 0;
+		previewColors.resize(static_cast<size_t>(width) * height);
+		accumulation.resize(static_cast<size_t>(width) * height);
+	}
+
+	tileScheduler.beginFrame(width, height);
+	const int tileCount = tileScheduler.getTileCount();
+
+	if (progressiveBlock > 1)
+	{
+		// each coarse pass only traces the block corners the previous pass did not, so reaching full resolution costs
+		// exactly one ray per pixel; the fill runs after every tile is traced because blocks may span tiles
+		progressiveBlock /= 2;
+		const int block = progressiveBlock;
+		threadPool.parallelFor(0, tileCount, 1, [this, width, height, block](int tileIndex)
+		{
+			PROFILE_SCOPE("tile");
+			tracePreviewTile(tileScheduler.getTile(tileIndex), width, height, block);
+		});
+
+		if (block > 1)
+		{
+			threadPool.parallelFor(0, tileCount, 1, [this, &framebuffer, block](int tileIndex)
+			{
+				fillPreviewTile(framebuffer, tileScheduler.getTile(tileIndex), block);
+			});
+			return;
+		}
+
+		// the full-resolution pass becomes the first accumulated sample
+		accumulation = previewColors;
+		accumulatedSamples = 1;
+		threadPool.parallelFor(0, tileCount, 1, [this, &framebuffer](int tileIndex)
+		{
+			accumulateTile(framebuffer, tileScheduler.getTile(tileIndex), false);
 		});
+		return;
+	}
 
-		futures.push_back(std::move(future));
+	// converged images are still written because the caller may hand over a different buffer every frame
+	const bool traceSample = accumulatedSamples < maxAccumulatedSamples;
+	if (traceSample)
+		accumulatedSamples++;
+
+	threadPool.parallelFor(0, tileCount, 1, [this, &framebuffer, traceSample](int tileIndex)
+	{
+		PROFILE_SCOPE("tile");
+		accumulateTile(framebuffer, tileScheduler.getTile(tileIndex), traceSample);
+	});
+}
+
+void Raytracer::tracePreviewTile(const Tile& tile, int width, int height, int block)
+{
+	const int firstY = (tile.y0 + block - 1) / block * block;
+	const int firstX = (tile.x0 + block - 1) / block * block;
+	for (int y = firstY; y < tile.y1; y += block)
+	{
+		for (int x = firstX; x < tile.x1; x += block)
+		{
+			// corners on the grid of twice the block size were traced by the previous pass
+			if (block < progressiveStartBlock && x % (block * 2) == 0 && y % (block * 2) == 0)
+				continue;
+
+			const Vector3 rayDirection = computePrimaryRayDirection(x + 0.5f, y + 0.5f, width, height);
+			previewColors[static_cast<size_t>(y) * width + x] = traceRay(frameCamera.position, rayDirection, recursionLimit);
+		}
 	}
+}
+
+void Raytracer::fillPreviewTile(const Framebuffer& framebuffer, const Tile& tile, int block)
+{
+	writeTile(framebuffer, tile, [this, &framebuffer, block](int x, int y)
+	{
+		return previewColors[static_cast<size_t>(y - y % block) * framebuffer.width + x - x % block];
+	});
+}
+
+void Raytracer::accumulateTile(const Framebuffer& framebuffer, const Tile& tile, bool traceSample)
+{
+	const float weight = 1.0f / accumulatedSamples;
+
+	writeTile(framebuffer, tile, [this, &framebuffer, traceSample, weight](int x, int y)
+	{
+		FloatColor& sum = accumulation[static_cast<size_t>(y) * framebuffer.width + x];
+		if (traceSample)
+		{
+			// sample 0 was the pixel center, later ones follow the R2 sequence
+			float offsetX;
+			float offsetY;
+			computeSampleOffset(accumulatedSamples - 1, maxAccumulatedSamples, offsetX, offsetY);
+
+			const Vector3 rayDirection = computePrimaryRayDirection(x + offsetX, y + offsetY, framebuffer.width, framebuffer.height);
+			sum += traceRay(frameCamera.position, rayDirection, recursionLimit);
+		}
+
+		return sum * weight;
+	});
+}
+
+Vector3 Raytracer::computePrimaryRayDirection(float pixelX, float pixelY, int width, int height) const
+{
+	// calculate NDC coordinates and adjust for aspect ratio
+	float ndcX = pixelX / width * 2.0f - 1.0f;
+	float ndcY = 1.0f - pixelY / height * 2.0f; // flip y so +y is up
+	ndcX *= aspectRatio * halfFovTan;
+	ndcY *= halfFovTan;
 
-	for (auto& future : futures)
+	Vector3 rayDirection = frameCamera.forward + (frameCamera.right * ndcX) + (frameCamera.up * ndcY);
+	rayDirection.normalize();
+	return rayDirection;
+}
+
+void Raytracer::computeSampleOffset(int sampleIndex, int sampleCount, float& offsetX, float& offsetY)
+{
+	if (sampleCount <= 1)
 	{
-		future.get();
+		offsetX = 0.5f;
+		offsetY = 0.5f;
+		return;
 	}
+
+	// R2 low-discrepancy sequence, deterministic so offline renders are reproducible
+	constexpr float alphaX = 0.7548776662f;
+	constexpr float alphaY = 0.5698402910f;
+	const float sampleX = 0.5f + alphaX * sampleIndex;
+	const float sampleY = 0.5f + alphaY * sampleIndex;
+	offsetX = sampleX - std::floor(sampleX);
+	offsetY = sampleY - std::floor(sampleY);
 }
 
-float Raytracer::intersectRaySphere(const Vector3& origin, const Vector3& direction, const Sphere& sphere) const
+float Raytracer::intersectRaySphere(const Vector3& origin, const Vector3& direction, const Sphere& sphere)
 {
 	const Vector3 co = origin - sphere.center;
 	const float a = direction * direction;
@@ -100,7 +1120,7 @@ float Raytracer::intersectRaySphere(const Vector3& origin, const Vector3& direct
 }
 
 float Raytracer::computeBlinPhong(const Vector3& lightDir, const Vector3& normal, const Vector3& view,
-	float lightIntensity, float lambertTerm, float specularTerm) const
+	float lightIntensity, float lambertTerm, float specularTerm)
 {
 	float intensity = 0.0f;
 
@@ -128,22 +1148,34 @@ Vector3 Raytracer::reflectRay(const Vector3& direction, const Vector3& normal)
 	return direction - normal * (2 * (direction * normal));
 }
 
-bool Raytracer::isShadowed(const Vector3& point, const Vector3& lightDir, float distanceToLight) const
+Color Raytracer::heatmapColor(float value)
 {
-	for (const auto& sphere : spheres)
+	constexpr int stopCount = 6;
+	constexpr float stops[stopCount][3] = { { 0, 0, 0 }, { 0, 0, 255 }, { 0, 255, 255 }, { 0, 255, 0 }, { 255, 255, 0 }, { 255, 0, 0 } };
+
+	const float position = std::clamp(value, 0.0f, 1.0f) * (stopCount - 1);
+	const int index = std::min(static_cast<int>(position), stopCount - 2);
+	const float weight = position - index;
+	const auto blend = [&](int channel)
 	{
-		const float distance = intersectRaySphere(point, lightDir, sphere);
-		if (distance > minDistance && distance < distanceToLight)
-		{
-			return true;
-		}
-	}
+		return static_cast<uint8_t>(stops[index][channel] + (stops[index + 1][channel] - stops[index][channel]) * weight + 0.5f);
+	};
+	return { blend(0), blend(1), blend(2), 0 };
+}
 
-	return false;
+bool Raytracer::isShadowed(const Vector3& point, const Vector3& lightDir, float distanceToLight) const
+{
+	RAYTRACER_COUNT(shadowRays, 1);
+	return bvh.traverseAny(point, lightDir, distanceToLight, [&](int first, int count)
+	{
+		RAYTRACER_COUNT(intersectionTests, count);
+		return geometry.occludes(point, lightDir, first, count, minDistance, distanceToLight);
+	});
 }
 
-float Raytracer::computeLightingIntensity(const Vector3& point, const Vector3& normal, const Vector3& view,
-	const Sphere& sphere)
+template<typename F>
+float Raytracer::accumulateLighting(const Vector3& point, const Vector3& normal, const Vector3& view,
+	const Material& material, F&& isLit) const
 {
 	float intensity = 0.0f;
 
@@ -152,11 +1184,11 @@ float Raytracer::computeLightingIntensity(const Vector3& point, const Vector3& n
 		intensity += ambient.intensity;
 	}
 
-	for (auto& dirLight : directionalLights)
+	int light = 0;
+	for (const auto& dirLight : directionalLights)
 	{
-		dirLight.direction.normalize();
-		if (!isShadowed(point, dirLight.direction, maxDistance))
-			intensity += computeBlinPhong(dirLight.direction, normal, view, dirLight.intensity, sphere.lambert, sphere.specular);
+		if (isLit(light++, dirLight.direction, maxDistance))
+			intensity += computeBlinPhong(dirLight.direction, normal, view, dirLight.intensity, material.lambert, material.specular);
 	}
 
 	for (const auto& pointLight : pointLights)
@@ -166,63 +1198,230 @@ float Raytracer::computeLightingIntensity(const Vector3& point, const Vector3& n
 		lightDir.x /= distance;
 		lightDir.y /= distance;
 		lightDir.z /= distance;
-		if (!isShadowed(point, lightDir, distance))
-			intensity += computeBlinPhong(lightDir, normal, view, pointLight.intensity, sphere.lambert, sphere.specular);
+		if (isLit(light++, lightDir, distance))
+			intensity += computeBlinPhong(lightDir, normal, view, pointLight.intensity, material.lambert, material.specular);
 	}
 
 	return intensity;
 }
 
-void Raytracer::findClosestIntersection(const Vector3& origin, const Vector3& direction, float& closest,
-	Sphere& closestSphere) const
+float Raytracer::computeLightingIntensity(const Vector3& point, const Vector3& normal, const Vector3& view,
+	const Material& material) const
 {
-	for (const auto& sphere : spheres)
+	return accumulateLighting(point, normal, view, material, [&](int, const Vector3& lightDir, float distanceToLight)
 	{
-		const float distance = intersectRaySphere(origin, direction, sphere);
-		if (distance > minDistance && distance < closest)
+		return !isShadowed(point, lightDir, distanceToLight);
+	});
+}
+
+bool Raytracer::findClosestIntersection(const Vector3& origin, const Vector3& direction, HitRecord& hit) const
+{
+	hit.t = maxDistance;
+	hit.primitive = -1;
+
+	bvh.traverse(origin, direction, hit.t, [&](int first, int count, float& nearest)
+	{
+		RAYTRACER_COUNT(intersectionTests, count);
+		const int slot = geometry.intersectClosest(origin, direction, first, count, minDistance, nearest);
+		if (slot >= 0)
 		{
-			closest = distance;
-			closestSphere = sphere;
+			hit.primitive = bvh.primitiveIndices[slot];
 		}
-	}
+	});
+
+	if (hit.primitive < 0)
+		return false;
+
+	hit.normal = origin + direction * hit.t - spheres[hit.primitive].center;
+	hit.normal.normalize();
+	return true;
 }
 
-Color Raytracer::calculateLightingColor(const Vector3& point, const Vector3& normal, const Vector3& view,
-	const Sphere& sphere)
+FloatColor Raytracer::calculateLightingColor(const Vector3& point, const Vector3& normal, const Vector3& view,
+	const Material& material)
 {
-	const float intensity = computeLightingIntensity(point, normal, view, sphere);
-	Color white = { 255, 255, 255, 0 }; // TODO: colored light calculation
-	white.clampMultiplyFloat(intensity);
-	return sphere.color * white;
+	// not clamped, an intensity above 1 is a highlight the tone mapper decides about
+	const float intensity = computeLightingIntensity(point, normal, view, material);
+	return FloatColor::fromColor(material.color) * intensity; // TODO: colored light calculation
 }
 
-Color Raytracer::traceRay(const Vector3& origin, const Vector3& direction, int recursionDepth)
+FloatColor Raytracer::traceRay(const Vector3& origin, const Vector3& direction, int recursionDepth, HitRecord* primaryHit)
 {
-	Color color = { 0, 0, 0, 0 }; // background color
-	float closest = maxDistance;
-	Sphere closestSphere{};
+	FloatColor color = { 0, 0, 0, 0 }; // background color
+	HitRecord hit;
 
-	findClosestIntersection(origin, direction, closest, closestSphere);
-	if (epsilonEquals(closest, maxDistance) || closest > maxDistance)
+#if RAYTRACER_ENABLE_STATS
+	const int depth = recursionLimit - recursionDepth;
+	RayCounters& stats = RayStats::local();
+	(depth == 0 ? stats.primaryRays : stats.reflectionRays)++;
+	stats.depthHistogram[std::min(depth, RayCounters::depthBuckets - 1)]++;
+#endif
+
+	const bool found = findClosestIntersection(origin, direction, hit);
+	if (primaryHit)
+		*primaryHit = hit;
+
+	if (!found)
 	{
 		return color;
 	}
 
-	const Vector3 point = origin + direction * closest;
-	Vector3 normal = point - closestSphere.center;
-	normal.normalize();
-	const Vector3 view = -camera.forward;
-	color = calculateLightingColor(point, normal, view, closestSphere);
+	return shadeHit(origin, direction, hit, recursionDepth);
+}
 
-	const float reflectivity = closestSphere.reflectivity;
-	if (recursionDepth <= 0 || epsilonEquals(reflectivity, 0.0f))
+void Raytracer::findPacketIntersections(RayPacket& packet) const
+{
+	const Vector3& origin = frameCamera.position;
+	bvh.traversePacket(origin, packet, [&](int first, int count)
 	{
-		return color;
+		RAYTRACER_COUNT(intersectionTests, count * RayPacket::size);
+		geometry.intersectPacket(origin, packet, first, count, minDistance);
+	});
+}
+
+void Raytracer::tracePacket(RayPacket& packet, int columns, int rows, FloatColor* colors)
+{
+	const Vector3& origin = frameCamera.position;
+	findPacketIntersections(packet);
+
+	RAYTRACER_COUNT(primaryRays, columns * rows);
+	RAYTRACER_COUNT(depthHistogram[0], columns * rows);
+
+	for (int row = 0; row < rows; row++)
+	{
+		for (int column = 0; column < columns; column++)
+		{
+			const int lane = row * RayPacket::width + column;
+			const int slot = packet.slots[lane];
+			if (slot < 0)
+			{
+				colors[lane] = { 0, 0, 0, 0 }; // background color
+				continue;
+			}
+
+			const Vector3 direction = packet.getDirection(lane);
+			HitRecord hit;
+			hit.t = packet.closest[lane];
+			hit.primitive = bvh.primitiveIndices[slot];
+			hit.normal = origin + direction * hit.t - spheres[hit.primitive].center;
+			hit.normal.normalize();
+			colors[lane] = shadeHit(origin, direction, hit, recursionLimit);
+		}
 	}
+}
+
+namespace
+{
+	// one surface along a reflection path, blended into the pixel once the path is complete
+	class PathVertex
+	{
+	public:
+		FloatColor color; // local lighting
+		float reflectivity;
+		float reflectionScale; // factor of the reflected color, 0 if the reflection was cut off
+		bool reflects; // false if the surface keeps its full local color
+	};
+
+	// uniform number in [0, 1) derived from a ray, so the roulette decisions are the same every frame and on every path
+	float hashRay(const Vector3& origin, const Vector3& direction)
+	{
+		uint32_t hash = 2166136261u;
+		for (const float value : { origin.x, origin.y, origin.z, direction.x, direction.y, direction.z })
+		{
+			uint32_t bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+			hash = (hash ^ bits) * 16777619u;
+		}
+		hash ^= hash >> 15;
+		hash *= 0x2c1b3c6du;
+		hash ^= hash >> 12;
+		return (hash >> 8) * (1.0f / 16777216.0f);
+	}
+}
 
-	const Vector3 reflectedRay = reflectRay(direction, normal);
-	const Color reflectedColor = traceRay(point, reflectedRay, recursionDepth - 1);
+FloatColor Raytracer::shadeHit(const Vector3& origin, const Vector3& direction, const HitRecord& hit, int recursionDepth)
+{
+	const Material& material = materials[spheres[hit.primitive].material];
+	const FloatColor surfaceColor = calculateLightingColor(origin + direction * hit.t, hit.normal, -frameCamera.forward, material);
+	return shadeHit(origin, direction, hit, recursionDepth, surfaceColor);
+}
+
+// the path is followed in a loop that records every surface, then blended from the deepest surface back to the first
+FloatColor Raytracer::shadeHit(const Vector3& origin, const Vector3& direction, const HitRecord& hit, int recursionDepth,
+	const FloatColor& surfaceColor)
+{
+	PathVertex path[recursionLimit + 1];
+	int pathLength = 0;
+
+	Vector3 rayOrigin = origin;
+	Vector3 rayDirection = direction;
+	HitRecord rayHit = hit;
+	float throughput = 1.0f;
+	for (int bouncesLeft = std::min(recursionDepth, recursionLimit); ; bouncesLeft--)
+	{
+		const Material& material = materials[spheres[rayHit.primitive].material];
+		const Vector3 point = rayOrigin + rayDirection * rayHit.t;
+		const Vector3 view = -frameCamera.forward;
+
+		PathVertex& vertex = path[pathLength++];
+		vertex.color = pathLength == 1 ? surfaceColor : calculateLightingColor(point, rayHit.normal, view, material);
+		vertex.reflectivity = material.reflectivity;
+		vertex.reflectionScale = 0;
+		vertex.reflects = bouncesLeft > 0 && !epsilonEquals(material.reflectivity, 0.0f);
+		if (!vertex.reflects)
+			break;
+
+		const Vector3 reflectedRay = reflectRay(rayDirection, rayHit.normal);
+		vertex.reflectionScale = computeReflectionScale(throughput, material.reflectivity, point, reflectedRay);
+		if (vertex.reflectionScale == 0)
+			break;
+
+#if RAYTRACER_ENABLE_STATS
+		const int depth = recursionLimit - bouncesLeft + 1;
+		RayCounters& stats = RayStats::local();
+		stats.reflectionRays++;
+		stats.depthHistogram[std::min(depth, RayCounters::depthBuckets - 1)]++;
+#endif
+
+		throughput *= vertex.reflectionScale;
+		rayOrigin = point;
+		rayDirection = reflectedRay;
+		if (!findClosestIntersection(rayOrigin, rayDirection, rayHit))
+			break;
+	}
+
+	FloatColor color = { 0, 0, 0, 0 }; // background color, seen by a reflection that misses or is cut off
+	for (int i = pathLength - 1; i >= 0; i--)
+	{
+		const PathVertex& vertex = path[i];
+		if (!vertex.reflects)
+		{
+			color = vertex.color;
+			continue;
+		}
+
+		color = vertex.color * (1 - vertex.reflectivity) + color * vertex.reflectionScale;
+	}
+
+	return color;
+}
+
+float Raytracer::computeReflectionScale(float throughput, float reflectivity, const Vector3& origin, const Vector3& direction) const
+{
+	const float weight = throughput * reflectivity;
+	if (weight < minThroughput)
+		return 0;
+
+	if (russianRoulette && weight < rouletteThroughput)
+	{
+		// survivors carry the weight of the terminated paths, which keeps the expected color unchanged
+		const float survival = weight / rouletteThroughput;
+		if (hashRay(origin, direction) >= survival)
+			return 0;
+
+		return reflectivity / survival;
+	}
 
-	return color * (1 - reflectivity) + reflectedColor * reflectivity;
+	return reflectivity;
 }
 
@@ -1,15 +1,31 @@
 #pragma once
 
+#include <chrono>
 #include <cmath>
 #include <limits>
-#include <SDL.h>
 #include <vector>
 
+#include "BVH.h"
 #include "Camera.h"
 #include "Color.h"
+#include "FloatColor.h"
+#include "Framebuffer.h"
+#include "HitRecord.h"
+#include "Image.h"
 #include "Light.h"
+#include "Material.h"
+#include "QueuePacket.h"
+#include "RayPacket.h"
+#include "RayQueue.h"
+#include "RaySorter.h"
+#include "RayStats.h"
+#include "RenderMode.h"
 #include "Sphere.h"
+#include "TemporalHistory.h"
+#include "SphereGeometry.h"
 #include "ThreadPool.h"
+#include "TileScheduler.h"
+#include "ToneMapper.h"
 #include "Vector3.h"
 
 // TODO: fix the additive light color
@@ -22,33 +38,203 @@ class Raytracer
 {
 public:
 	Raytracer(Camera& camera, float minDistance, float maxDistance, float aspectRatio, float fov);
-	void render(SDL_Renderer* renderer, SDL_Surface* surface, SDL_Texture* texture);
+	// traces one frame into caller-owned pixel memory
+	void render(const Framebuffer& framebuffer);
+	// pipelined variant of render: snapshots the camera, starts tracing on the pool and returns right away so the
+	// caller can present the previous frame; the framebuffer and the scene must stay untouched until endRender
+	void beginRender(const Framebuffer& framebuffer);
+	// helps trace the frame started by beginRender and returns once it is complete
+	void endRender();
+	// offline path: traces samplesPerPixel rays per pixel into a caller-owned float image
+	void renderImage(Image& image, int samplesPerPixel);
+	// offline path of the heatmap modes, traces one ray per pixel and writes the false colors into the image
+	void renderHeatmap(Image& image, RenderMode metric);
+	void setSpheres(const std::vector<Sphere>& newSpheres);
+	void setMaterials(const std::vector<Material>& newMaterials);
+	void setTileSize(int tileSize);
+	void setRenderMode(RenderMode mode) { renderMode = mode; }
+	// progressive refinement of shaded frames: after the camera, the scene or the frame size changes the next frames
+	// trace one ray per 8x8, 4x4 and 2x2 block, then every pixel, then accumulate jittered samples while nothing moves
+	void setProgressive(bool enabled);
+	bool isProgressive() const { return progressive; }
+	// samples per pixel accumulated in the last frame, 0 while the coarse passes are still running
+	int getAccumulatedSamples() const { return frameSamples; }
+	// adaptive primary sampling of non-progressive shaded frames: every tile traces a sparse grid and only traces the
+	// pixels of grid cells whose corners differ in object, depth or color or through which another sphere may show, the
+	// other cells are interpolated; lossy, shadows and reflections smaller than a cell can still be smoothed away
+	void setAdaptive(bool enabled) { adaptive = enabled; }
+	bool isAdaptive() const { return adaptive; }
+	// temporal reuse for non-progressive shaded frames: pixels inside a region whose reprojected samples of the previous
+	// frame agree on the sphere and its lit lights intersect only that sphere and reuse the shadow tests, highlights and
+	// reflections are still evaluated; lossy, shadows and objects narrower than a pixel can be missed until the pixel is
+	// refreshed; takes precedence over adaptive sampling
+	void setTemporalReuse(bool enabled) { temporalReuse = enabled; }
+	bool isTemporalReuse() const { return temporalReuse; }
+	// full-resolution shaded frames trace their primary rays in square packets that share one traversal, reflection
+	// and shadow rays are traced one at a time except in wavefront mode; on by default
+	void setPacketTracing(bool enabled) { packetTracing = enabled; }
+	bool isPacketTracing() const { return packetTracing; }
+	// breadth-first tracing of full-resolution shaded frames: batches of pixels run intersection, shading, shadow and
+	// resolve stages over whole ray queues, one round per bounce, with colors summed in floats; with packet tracing on,
+	// primary and shadow rays and the sorted reflection rays are traced in QueuePackets. Adaptive sampling and temporal
+	// reuse take precedence over it: with either of them on, setWavefront(true) has no effect until they are off
+	void setWavefront(bool enabled) { wavefront = enabled; }
+	bool isWavefront() const { return wavefront; }
+	// wavefront mode: shadow and reflection rays are traced in RaySorter order (direction octant, then origin along a
+	// Morton curve) instead of pixel order, so neighbors in the queue form coherent packets; on by default
+	void setRaySorting(bool enabled) { raySorting = enabled; }
+	bool isRaySorting() const { return raySorting; }
+	// reflections whose share of the pixel (the product of the reflectivities along the path) falls below the threshold
+	// are not traced and blend in as black; the default of half an 8-bit level never changes a pixel visibly
+	void setMinThroughput(float threshold) { minThroughput = threshold; }
+	float getMinThroughput() const { return minThroughput; }
+	// russian roulette for reflections weighted below 0.1: they are traced with a probability proportional to their
+	// weight and scaled up when they survive, which trades noise for fewer rays; off by default
+	void setRussianRoulette(bool enabled) { russianRoulette = enabled; }
+	bool isRussianRoulette() const { return russianRoulette; }
+	// shaded frames are traced into float colors and quantized by this tone mapper as each span is written; the default
+	// clamps like the former 8-bit pipeline, offline renders stay linear and are tone mapped by Image::save instead
+	void setToneMapper(const ToneMapper& mapper) { toneMapper = mapper; }
+	const ToneMapper& getToneMapper() const { return toneMapper; }
+	RenderMode getRenderMode() const { return renderMode; }
+	// ray counters of the last render or renderImage call, all zero when built with RAYTRACER_ENABLE_STATS=0
+	const RayCounters& getFrameStats() const { return frameStats; }
+	// time the workers spent on the last render or beginRender frame, excluding any wait before endRender
+	double getFrameMilliseconds() const { return frameMilliseconds; }
+
+	// stateless kernels, public so the benchmarks can time them in isolation
+	static float intersectRaySphere(const Vector3& origin, const Vector3& direction, const Sphere& sphere);
+	static float computeBlinPhong(const Vector3& lightDir, const Vector3& normal, const Vector3& view, float lightIntensity, float lambertTerm, float specularTerm);
+	static Vector3 reflectRay(const Vector3& direction, const Vector3& normal);
+	// cool to hot ramp over [0, 1]: black, blue, cyan, green, yellow, red
+	static Color heatmapColor(float value);
 private:
 	std::vector<Sphere> spheres;
+	std::vector<Material> materials;
+	BVH bvh; // rebuilt by setSpheres, must stay in sync with spheres
+	SphereGeometry geometry; // sphere geometry in bvh leaf order
 	std::vector<PointLight> pointLights;
 	std::vector<DirectionalLight> directionalLights;
 	std::vector<AmbientLight> ambientLights;
 
 	Camera& camera;
+	Camera frameCamera; // copy of camera taken when a frame starts, so the caller may move the camera while it is traced
 	float minDistance;
 	float maxDistance;
 	float aspectRatio;
 	float fov;
 	float halfFovTan;
 
-	const int recursionLimit = 3;
+	static constexpr int recursionLimit = 3;
+	static constexpr float rouletteThroughput = 0.1f; // paths weighted below this face russian roulette when it is on
+	float minThroughput = 0.5f / 255; // a reflection weighted below this cannot move the pixel by half a level
+	bool russianRoulette = false;
+	static constexpr int defaultTileSize = 16;
 	ThreadPool threadPool;
+	TileScheduler tileScheduler;
+	RayCounters frameStats;
+	RenderMode renderMode = RenderMode::Shaded;
+	ToneMapper toneMapper;
+	TaskGroup frameGroup; // the frame in flight between beginRender and endRender
+	Task frameTask;
+	Framebuffer pendingFramebuffer;
+	std::chrono::steady_clock::time_point frameStartTime;
+	double renderMilliseconds = 0; // written by the frame task
+	// reported values of the last completed frame, only written on the calling thread so they can be read while the
+	// next frame is in flight
+	double frameMilliseconds = 0;
+	int frameSamples = 0;
 
-	void renderProjection(SDL_Renderer* renderer, SDL_Surface* surface, SDL_Texture* texture);
-	float intersectRaySphere(const Vector3& origin, const Vector3& direction, const Sphere& sphere) const;
-	float computeBlinPhong(const Vector3& lightDir, const Vector3& normal, const Vector3& view, float lightIntensity, float lambertTerm, float specularTerm) const;
-	static Vector3 reflectRay(const Vector3& direction, const Vector3& normal);
-	bool isShadowed(const Vector3& point, const Vector3& lightDir, float distanceToLight) const;
-	float computeLightingIntensity(const Vector3& point, const Vector3& normal, const Vector3& view, const Sphere& sphere);
-	void findClosestIntersection(const Vector3& origin, const Vector3& direction, float& closest, Sphere& closestSphere) const;
-	Color calculateLightingColor(const Vector3& point, const Vector3& normal, const Vector3& view, const Sphere& sphere);
-	Color traceRay(const Vector3& origin, const Vector3& direction, int recursionDepth);
+	static constexpr int progressiveStartBlock = 8; // power of two
+	static constexpr int maxAccumulatedSamples = 256; // converged frames are only repacked, not traced
+	bool progressive = false;
+	bool progressiveValid = false; // false forces a restart at progressiveStartBlock
+	int progressiveBlock = 0; // block size of the last coarse pass, 1 once every pixel has been traced
+	int accumulatedSamples = 0;
+	uint64_t sceneVersion = 0; // bumped by the scene setters
+	uint64_t progressiveSceneVersion = 0;
+	Camera progressiveCamera;
+	int progressiveWidth = 0;
+	int progressiveHeight = 0;
+	std::vector<FloatColor> previewColors; // coarse passes, colors of the traced block corners
+	std::vector<FloatColor> accumulation; // sums of every sample per pixel
+
+	static constexpr int adaptiveGridStep = 4;
+	static constexpr float adaptiveColorThreshold = 8.0f / 255; // largest channel difference between corners that is interpolated
+	static constexpr float adaptiveDepthThreshold = 0.05f; // largest corner depth difference relative to the nearer one
+	bool adaptive = false;
 
-	static Uint32* getPixel(const SDL_Surface* surface, int x, int y);
-	static void setPixel(const SDL_Surface* surface, int x, int y, Color color);
+	bool packetTracing = true;
+
+	static constexpr int wavefrontBatchSize = 1 << 16; // pixels per batch, keeps the queues of one batch in cache
+	static constexpr int wavefrontGrain = 256; // rays per parallelFor chunk
+	bool wavefront = false;
+	RayQueue rayQueue; // rays of the current bounce
+	RayQueue reflectionQueue; // reflection rays spawned by the current bounce, at the index of their parent ray
+	RayQueue shadowQueue; // one ray per light and hit, at the parent ray index times the light count plus the light
+	std::vector<int> hitPrimitives; // closest hit per ray of the current bounce, -1 on a miss
+	std::vector<float> hitDistances;
+	std::vector<char> hitReflects; // whether the ray spawned a reflection ray
+	std::vector<FloatColor> wavefrontColors; // sums per pixel
+	bool raySorting = true;
+	RaySorter raySorter;
+
+	bool temporalReuse = false;
+	TemporalHistory history;
+	std::vector<float> pixelCosts; // heatmap modes only, one entry per pixel in row-major order
+	std::vector<float> sortedCosts; // scratch for the time percentile
+
+	void renderFrame(const Framebuffer& framebuffer);
+	void renderProjection(const Framebuffer& framebuffer);
+	void renderProgressive(const Framebuffer& framebuffer);
+	void tracePreviewTile(const Tile& tile, int width, int height, int block);
+	void fillPreviewTile(const Framebuffer& framebuffer, const Tile& tile, int block);
+	void accumulateTile(const Framebuffer& framebuffer, const Tile& tile, bool traceSample);
+	// calls shadePixel(x, y) for every pixel of the tile and tone maps the returned FloatColors into the framebuffer a
+	// span at a time; every tile path writes through here
+	template<typename F>
+	void writeTile(const Framebuffer& framebuffer, const Tile& tile, F&& shadePixel);
+	void renderTile(const Framebuffer& framebuffer, const Tile& tile);
+	void renderWavefront(const Framebuffer& framebuffer);
+	void intersectRayQueue(int bounce);
+	void shadeRayQueue(int bounce);
+	void traceShadowQueue();
+	// computes the RaySorter keys of the rays of the queue for which isTraced(index) holds, the others are skipped
+	template<typename F>
+	void sortRays(const RayQueue& queue, F&& isTraced);
+	void resolveRayQueue();
+	void compactReflectionQueue();
+	void renderPacketTile(const Framebuffer& framebuffer, const Tile& tile);
+	void renderAdaptiveTile(const Framebuffer& framebuffer, const Tile& tile);
+	// whether a sphere other than primitive (-1 for the background) may be hit by a primary ray between the four corner
+	// directions, given in order around the cell; conservative, so false means every such ray sees primitive
+	bool mayRevealOtherPrimitive(const Vector3 (&corners)[4], int primitive) const;
+	void renderTemporalTile(const Framebuffer& framebuffer, const Tile& tile, bool reuse);
+	void renderImageTile(Image& image, const Tile& tile, int samplesPerPixel);
+	void measurePixelCosts(int width, int height, RenderMode metric);
+	void measureTileCosts(const Tile& tile, int width, int height, RenderMode metric);
+	float computeHeatmapScale(RenderMode metric);
+	Vector3 computePrimaryRayDirection(float pixelX, float pixelY, int width, int height) const;
+	static void computeSampleOffset(int sampleIndex, int sampleCount, float& offsetX, float& offsetY);
+	bool isShadowed(const Vector3& point, const Vector3& lightDir, float distanceToLight) const;
+	// ambient light plus the Blinn-Phong terms of the lights for which isLit(lightIndex, lightDir, distanceToLight) holds;
+	// directional lights are numbered before point lights
+	template<typename F>
+	float accumulateLighting(const Vector3& point, const Vector3& normal, const Vector3& view, const Material& material, F&& isLit) const;
+	float computeLightingIntensity(const Vector3& point, const Vector3& normal, const Vector3& view, const Material& material) const;
+	bool findClosestIntersection(const Vector3& origin, const Vector3& direction, HitRecord& hit) const;
+	FloatColor calculateLightingColor(const Vector3& point, const Vector3& normal, const Vector3& view, const Material& material);
+	// primaryHit, if given, receives the first intersection (primitive -1 on a miss)
+	FloatColor traceRay(const Vector3& origin, const Vector3& direction, int recursionDepth, HitRecord* primaryHit = nullptr);
+	// primary rays of the packet from the frame camera, colors of the first columns x rows block of lanes in row-major
+	// packet order
+	void tracePacket(RayPacket& packet, int columns, int rows, FloatColor* colors);
+	// closest hits of every ray of a packet starting at the frame camera, written to packet.closest and packet.slots
+	void findPacketIntersections(RayPacket& packet) const;
+	// color of a hit and the reflections it spawns, following at most recursionDepth bounces
+	FloatColor shadeHit(const Vector3& origin, const Vector3& direction, const HitRecord& hit, int recursionDepth);
+	// as above with the local lighting of the hit itself given, e.g. computed from shadow tests of an earlier frame
+	FloatColor shadeHit(const Vector3& origin, const Vector3& direction, const HitRecord& hit, int recursionDepth, const FloatColor& surfaceColor);
+	// factor from the throughput of a path to that of the reflection ray leaving a surface, 0 if the ray is cut off
+	float computeReflectionScale(float throughput, float reflectivity, const Vector3& origin, const Vector3& direction) const;
 };
\ No newline at end of file
@@ -0,0 +1,9 @@
+#pragma once
+
+// what render() writes: the shaded image, or a false-color map of how expensive every pixel was to trace
+enum class RenderMode
+{
+	Shaded,
+	TimeHeatmap, // wall-clock time per pixel
+	RayHeatmap // primary, shadow and reflection rays per pixel, needs RAYTRACER_ENABLE_STATS
+};
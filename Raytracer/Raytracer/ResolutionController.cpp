@@ -0,0 +1,44 @@
+#include "ResolutionController.h"
+
+#include <algorithm>
+#include <cmath>
+
+ResolutionController::ResolutionController(double targetMilliseconds, float minScale, float maxScale):
+	targetMilliseconds(targetMilliseconds), minScale(minScale), maxScale(maxScale), scale(maxScale)
+{
+}
+
+void ResolutionController::setTargetMilliseconds(double newTargetMilliseconds)
+{
+	targetMilliseconds = newTargetMilliseconds;
+	if (targetMilliseconds <= 0)
+		scale = maxScale;
+}
+
+void ResolutionController::addFrame(double renderMilliseconds)
+{
+	if (targetMilliseconds <= 0 || renderMilliseconds <= 0)
+		return;
+
+	averageMilliseconds = averageMilliseconds > 0 ? averageMilliseconds + smoothing * (renderMilliseconds - averageMilliseconds) : renderMilliseconds;
+
+	const double ratio = averageMilliseconds / targetMilliseconds;
+	if (std::abs(ratio - 1.0) <= tolerance)
+		return;
+
+	// tracing cost grows with the pixel count, so the side length scales with the square root of the time ratio
+	const float step = std::clamp(static_cast<float>(std::sqrt(1.0 / ratio)), maxShrink, maxGrow);
+	const float newScale = std::clamp(scale * step, minScale, maxScale);
+	if (newScale == scale)
+		return;
+
+	// predict the time at the new scale so the average does not keep pushing in the same direction
+	averageMilliseconds *= (newScale * newScale) / (scale * scale);
+	scale = newScale;
+}
+
+void ResolutionController::getRenderSize(int fullWidth, int fullHeight, int& width, int& height) const
+{
+	width = std::clamp(static_cast<int>(std::lround(fullWidth * scale)), std::min(8, fullWidth), fullWidth);
+	height = std::clamp(static_cast<int>(std::lround(fullHeight * scale)), std::min(8, fullHeight), fullHeight);
+}
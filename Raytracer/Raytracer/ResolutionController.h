@@ -0,0 +1,31 @@
+#pragma once
+
+// picks the internal render resolution that keeps the measured tracing time near a frame-time budget; the traced
+// image is smaller than the window and gets scaled up when presented
+class ResolutionController
+{
+public:
+	// a budget of 0 or less disables scaling
+	explicit ResolutionController(double targetMilliseconds, float minScale = 0.25f, float maxScale = 1.0f);
+
+	void setTargetMilliseconds(double newTargetMilliseconds);
+	double getTargetMilliseconds() const { return targetMilliseconds; }
+	float getScale() const { return scale; }
+
+	// feeds the tracing time of the last frame and updates the scale
+	void addFrame(double renderMilliseconds);
+	// size to trace at for a window of fullWidth x fullHeight, never below 8x8
+	void getRenderSize(int fullWidth, int fullHeight, int& width, int& height) const;
+
+private:
+	static constexpr double smoothing = 0.25; // weight of the newest frame in the moving average
+	static constexpr double tolerance = 0.1; // relative distance from the budget that is left alone
+	static constexpr float maxShrink = 0.8f; // per-frame limits on the scale change, shrinking reacts faster than growing
+	static constexpr float maxGrow = 1.1f;
+
+	double targetMilliseconds;
+	float minScale;
+	float maxScale;
+	float scale;
+	double averageMilliseconds = 0;
+};
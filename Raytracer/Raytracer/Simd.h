@@ -0,0 +1,59 @@
+#pragma once
+
+#if defined(__AVX2__)
+#define RAYTRACER_SIMD_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define RAYTRACER_SIMD_SSE
+#include <emmintrin.h>
+#endif
+
+// thin wrappers over the widest enabled instruction set so the kernels are written once for both vector widths
+namespace Simd
+{
+#if defined(RAYTRACER_SIMD_AVX2)
+	constexpr int width = 8;
+	using FloatV = __m256;
+
+	inline FloatV load(const float* p) { return _mm256_loadu_ps(p); }
+	inline FloatV broadcast(float value) { return _mm256_set1_ps(value); }
+	inline FloatV laneIndices() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+	inline FloatV add(FloatV a, FloatV b) { return _mm256_add_ps(a, b); }
+	inline FloatV sub(FloatV a, FloatV b) { return _mm256_sub_ps(a, b); }
+	inline FloatV mul(FloatV a, FloatV b) { return _mm256_mul_ps(a, b); }
+	inline FloatV div(FloatV a, FloatV b) { return _mm256_div_ps(a, b); }
+	inline FloatV sqrt(FloatV a) { return _mm256_sqrt_ps(a); }
+	inline FloatV min(FloatV a, FloatV b) { return _mm256_min_ps(a, b); }
+	inline FloatV max(FloatV a, FloatV b) { return _mm256_max_ps(a, b); }
+	inline FloatV lessThan(FloatV a, FloatV b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+	inline FloatV lessEqual(FloatV a, FloatV b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+	inline FloatV bitAnd(FloatV a, FloatV b) { return _mm256_and_ps(a, b); }
+	inline FloatV select(FloatV mask, FloatV a, FloatV b) { return _mm256_blendv_ps(b, a, mask); }
+	inline FloatV absolute(FloatV a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+	inline int moveMask(FloatV a) { return _mm256_movemask_ps(a); }
+	inline void store(float* p, FloatV a) { _mm256_storeu_ps(p, a); }
+#elif defined(RAYTRACER_SIMD_SSE)
+	constexpr int width = 4;
+	using FloatV = __m128;
+
+	inline FloatV load(const float* p) { return _mm_loadu_ps(p); }
+	inline FloatV broadcast(float value) { return _mm_set1_ps(value); }
+	inline FloatV laneIndices() { return _mm_setr_ps(0, 1, 2, 3); }
+	inline FloatV add(FloatV a, FloatV b) { return _mm_add_ps(a, b); }
+	inline FloatV sub(FloatV a, FloatV b) { return _mm_sub_ps(a, b); }
+	inline FloatV mul(FloatV a, FloatV b) { return _mm_mul_ps(a, b); }
+	inline FloatV div(FloatV a, FloatV b) { return _mm_div_ps(a, b); }
+	inline FloatV sqrt(FloatV a) { return _mm_sqrt_ps(a); }
+	inline FloatV min(FloatV a, FloatV b) { return _mm_min_ps(a, b); }
+	inline FloatV max(FloatV a, FloatV b) { return _mm_max_ps(a, b); }
+	inline FloatV lessThan(FloatV a, FloatV b) { return _mm_cmplt_ps(a, b); }
+	inline FloatV lessEqual(FloatV a, FloatV b) { return _mm_cmple_ps(a, b); }
+	inline FloatV bitAnd(FloatV a, FloatV b) { return _mm_and_ps(a, b); }
+	inline FloatV select(FloatV mask, FloatV a, FloatV b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+	inline FloatV absolute(FloatV a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+	inline int moveMask(FloatV a) { return _mm_movemask_ps(a); }
+	inline void store(float* p, FloatV a) { _mm_storeu_ps(p, a); }
+#else
+	constexpr int width = 1;
+#endif
+}
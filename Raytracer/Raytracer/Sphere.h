@@ -1,5 +1,4 @@
 #pragma once
-#include "Color.h"
 #include "Vector3.h"
 
 class Sphere
@@ -7,8 +6,5 @@ class Sphere
 public:
 	Vector3 center;
 	float radius;
-	Color color;
-	float lambert;
-	float specular;
-	float reflectivity;
-};
\ No newline at end of file
+	int material; // index into the raytracer's material table
+};
@@ -0,0 +1,406 @@
+#include "SphereGeometry.h"
+
+#include <cmath>
+#include <limits>
+
+namespace
+{
+	constexpr float epsilon = std::numeric_limits<float>::epsilon();
+}
+
+void SphereGeometry::build(const std::vector<Sphere>& spheres, const std::vector<int>& order)
+{
+	// round up to the vector width and add one more vector of padding for loads starting mid-array
+	const size_t paddedSize = (order.size() + simdWidth - 1) / simdWidth * simdWidth + simdWidth;
+	x.assign(paddedSize, 0.0f);
+	y.assign(paddedSize, 0.0f);
+	z.assign(paddedSize, 0.0f);
+	radius.assign(paddedSize, 0.0f);
+
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		const Sphere& sphere = spheres[order[i]];
+		x[i] = sphere.center.x;
+		y[i] = sphere.center.y;
+		z[i] = sphere.center.z;
+		radius[i] = sphere.radius;
+	}
+}
+
+#if defined(RAYTRACER_SIMD_AVX2) || defined(RAYTRACER_SIMD_SSE)
+
+using namespace Simd;
+
+// Raytracer::intersectRaySphere evaluated lane by lane in single precision
+int SphereGeometry::intersectClosest(const Vector3& origin, const Vector3& direction, int first, int count,
+	float minDistance, float& closest) const
+{
+	const FloatV dx = broadcast(direction.x);
+	const FloatV dy = broadcast(direction.y);
+	const FloatV dz = broadcast(direction.z);
+	const float a = direction * direction;
+	const FloatV twoA = broadcast(2 * a);
+	const FloatV fourA = broadcast(4 * a);
+	const FloatV two = broadcast(2.0f);
+	const FloatV zero = broadcast(0.0f);
+	const FloatV minV = broadcast(minDistance);
+	const FloatV lanes = laneIndices();
+
+	int closestSlot = -1;
+	for (int base = first; base < first + count; base += simdWidth)
+	{
+		const FloatV cox = sub(broadcast(origin.x), load(&x[base]));
+		const FloatV coy = sub(broadcast(origin.y), load(&y[base]));
+		const FloatV coz = sub(broadcast(origin.z), load(&z[base]));
+		const FloatV r = load(&radius[base]);
+
+		const FloatV b = mul(two, add(add(mul(cox, dx), mul(coy, dy)), mul(coz, dz)));
+		const FloatV c = sub(add(add(mul(cox, cox), mul(coy, coy)), mul(coz, coz)), mul(r, r));
+		const FloatV discriminant = sub(mul(b, b), mul(fourA, c));
+
+		const FloatV negativeB = sub(zero, b);
+		const FloatV nearRoot = div(sub(negativeB, sqrt(discriminant)), twoA);
+		const FloatV tangentRoot = div(negativeB, twoA);
+		const FloatV t = select(lessThan(absolute(discriminant), broadcast(epsilon)), tangentRoot, nearRoot);
+
+		const FloatV inRange = lessThan(sub(lanes, broadcast(static_cast<float>(first + count - base))), zero);
+		FloatV valid = bitAnd(bitAnd(lessEqual(zero, discriminant), inRange), bitAnd(lessThan(minV, t), lessThan(t, broadcast(closest))));
+
+		int mask = moveMask(valid);
+		if (mask == 0)
+			continue;
+
+		float distances[simdWidth];
+		store(distances, t);
+		for (int lane = 0; mask != 0; lane++, mask >>= 1)
+		{
+			if ((mask & 1) && distances[lane] < closest)
+			{
+				closest = distances[lane];
+				closestSlot = base + lane;
+			}
+		}
+	}
+
+	return closestSlot;
+}
+
+// same arithmetic as the scalar fallback below
+bool SphereGeometry::occludes(const Vector3& origin, const Vector3& direction, int first, int count,
+	float minDistance, float maxDistance) const
+{
+	const FloatV dx = broadcast(direction.x);
+	const FloatV dy = broadcast(direction.y);
+	const FloatV dz = broadcast(direction.z);
+	const float a = direction * direction;
+	const FloatV aV = broadcast(a);
+	const FloatV zero = broadcast(0.0f);
+	const FloatV scaledMin = broadcast(minDistance * a);
+	const FloatV scaledMax = broadcast(maxDistance * a);
+	const FloatV lanes = laneIndices();
+
+	for (int base = first; base < first + count; base += simdWidth)
+	{
+		const FloatV cox = sub(broadcast(origin.x), load(&x[base]));
+		const FloatV coy = sub(broadcast(origin.y), load(&y[base]));
+		const FloatV coz = sub(broadcast(origin.z), load(&z[base]));
+		const FloatV r = load(&radius[base]);
+
+		const FloatV halfB = add(add(mul(cox, dx), mul(coy, dy)), mul(coz, dz));
+		const FloatV c = sub(add(add(mul(cox, cox), mul(coy, coy)), mul(coz, coz)), mul(r, r));
+		const FloatV discriminant = sub(mul(halfB, halfB), mul(aV, c));
+		const FloatV scaledDistance = sub(sub(zero, halfB), sqrt(discriminant));
+
+		const FloatV inRange = lessThan(sub(lanes, broadcast(static_cast<float>(first + count - base))), zero);
+		const FloatV ahead = bitAnd(lessEqual(zero, c), lessEqual(halfB, zero));
+		const FloatV blocks = bitAnd(bitAnd(lessThan(scaledMin, scaledDistance), lessThan(scaledDistance, scaledMax)), lessEqual(zero, discriminant));
+
+		if (moveMask(bitAnd(bitAnd(inRange, ahead), blocks)) != 0)
+			return true;
+	}
+
+	return false;
+}
+
+// intersectClosest with the roles swapped: the lanes hold rays instead of spheres, so the shared origin makes the
+// sphere terms scalar; same arithmetic per ray, so a packet finds the same hits as its rays traced one at a time
+void SphereGeometry::intersectPacket(const Vector3& origin, RayPacket& packet, int first, int count, float minDistance) const
+{
+	static_assert(RayPacket::size % simdWidth == 0, "packet rays must fill whole vectors");
+
+	const FloatV two = broadcast(2.0f);
+	const FloatV four = broadcast(4.0f);
+	const FloatV zero = broadcast(0.0f);
+	const FloatV minV = broadcast(minDistance);
+	const FloatV epsilonV = broadcast(epsilon);
+
+	for (int base = 0; base < RayPacket::size; base += simdWidth)
+	{
+		const FloatV dx = load(&packet.directionX[base]);
+		const FloatV dy = load(&packet.directionY[base]);
+		const FloatV dz = load(&packet.directionZ[base]);
+		const FloatV a = add(add(mul(dx, dx), mul(dy, dy)), mul(dz, dz));
+		const FloatV twoA = mul(two, a);
+		const FloatV fourA = mul(four, a);
+
+		FloatV nearest = load(&packet.closest[base]);
+		FloatV nearestSlots = broadcast(-1.0f); // slots travel as floats, exact below 2^24
+		for (int slot = first; slot < first + count; slot++)
+		{
+			const float cox = origin.x - x[slot];
+			const float coy = origin.y - y[slot];
+			const float coz = origin.z - z[slot];
+			const float c = cox * cox + coy * coy + coz * coz - radius[slot] * radius[slot];
+
+			const FloatV b = mul(two, add(add(mul(broadcast(cox), dx), mul(broadcast(coy), dy)), mul(broadcast(coz), dz)));
+			const FloatV discriminant = sub(mul(b, b), mul(fourA, broadcast(c)));
+
+			const FloatV negativeB = sub(zero, b);
+			const FloatV nearRoot = div(sub(negativeB, sqrt(discriminant)), twoA);
+			const FloatV tangentRoot = div(negativeB, twoA);
+			const FloatV t = select(lessThan(absolute(discriminant), epsilonV), tangentRoot, nearRoot);
+
+			const FloatV valid = bitAnd(lessEqual(zero, discriminant), bitAnd(lessThan(minV, t), lessThan(t, nearest)));
+			if (moveMask(valid) == 0)
+				continue;
+
+			nearest = select(valid, t, nearest);
+			nearestSlots = select(valid, broadcast(static_cast<float>(slot)), nearestSlots);
+		}
+
+		float slots[simdWidth];
+		store(&packet.closest[base], nearest);
+		store(slots, nearestSlots);
+		for (int lane = 0; lane < simdWidth; lane++)
+		{
+			if (slots[lane] >= 0)
+				packet.slots[base + lane] = static_cast<int>(slots[lane]);
+		}
+	}
+}
+
+// intersectClosest with rays in the lanes like the RayPacket overload, the origin terms now vary per lane
+void SphereGeometry::intersectPacket(QueuePacket& packet, int first, int count, float minDistance) const
+{
+	static_assert(QueuePacket::size % simdWidth == 0, "packet rays must fill whole vectors");
+
+	const FloatV two = broadcast(2.0f);
+	const FloatV four = broadcast(4.0f);
+	const FloatV zero = broadcast(0.0f);
+	const FloatV minV = broadcast(minDistance);
+	const FloatV epsilonV = broadcast(epsilon);
+
+	for (int base = 0; base < QueuePacket::size; base += simdWidth)
+	{
+		// inactive lanes have a negative closest distance, so no root is ever below it
+		FloatV nearest = load(&packet.closest[base]);
+		if (moveMask(lessEqual(zero, nearest)) == 0)
+			continue;
+
+		const FloatV ox = load(&packet.originX[base]);
+		const FloatV oy = load(&packet.originY[base]);
+		const FloatV oz = load(&packet.originZ[base]);
+		const FloatV dx = load(&packet.directionX[base]);
+		const FloatV dy = load(&packet.directionY[base]);
+		const FloatV dz = load(&packet.directionZ[base]);
+		const FloatV a = add(add(mul(dx, dx), mul(dy, dy)), mul(dz, dz));
+		const FloatV twoA = mul(two, a);
+		const FloatV fourA = mul(four, a);
+
+		FloatV nearestSlots = broadcast(-1.0f); // slots travel as floats, exact below 2^24
+		for (int slot = first; slot < first + count; slot++)
+		{
+			const FloatV cox = sub(ox, broadcast(x[slot]));
+			const FloatV coy = sub(oy, broadcast(y[slot]));
+			const FloatV coz = sub(oz, broadcast(z[slot]));
+			const float r = radius[slot];
+
+			const FloatV b = mul(two, add(add(mul(cox, dx), mul(coy, dy)), mul(coz, dz)));
+			const FloatV c = sub(add(add(mul(cox, cox), mul(coy, coy)), mul(coz, coz)), broadcast(r * r));
+			const FloatV discriminant = sub(mul(b, b), mul(fourA, c));
+
+			const FloatV negativeB = sub(zero, b);
+			const FloatV nearRoot = div(sub(negativeB, sqrt(discriminant)), twoA);
+			const FloatV tangentRoot = div(negativeB, twoA);
+			const FloatV t = select(lessThan(absolute(discriminant), epsilonV), tangentRoot, nearRoot);
+
+			const FloatV valid = bitAnd(lessEqual(zero, discriminant), bitAnd(lessThan(minV, t), lessThan(t, nearest)));
+			if (moveMask(valid) == 0)
+				continue;
+
+			nearest = select(valid, t, nearest);
+			nearestSlots = select(valid, broadcast(static_cast<float>(slot)), nearestSlots);
+		}
+
+		float slots[simdWidth];
+		store(&packet.closest[base], nearest);
+		store(slots, nearestSlots);
+		for (int lane = 0; lane < simdWidth; lane++)
+		{
+			if (slots[lane] >= 0)
+				packet.slots[base + lane] = static_cast<int>(slots[lane]);
+		}
+	}
+}
+
+// occludes with rays in the lanes; an occluded ray gets a negative distance to its light, which also stops the
+// remaining spheres from testing it
+bool SphereGeometry::occludesPacket(QueuePacket& packet, int first, int count, float minDistance) const
+{
+	static_assert(QueuePacket::size % simdWidth == 0, "packet rays must fill whole vectors");
+
+	const FloatV zero = broadcast(0.0f);
+	const FloatV inactive = broadcast(-1.0f);
+	const FloatV minV = broadcast(minDistance);
+	bool anyActive = false;
+
+	for (int base = 0; base < QueuePacket::size; base += simdWidth)
+	{
+		FloatV maxDistance = load(&packet.closest[base]);
+		if (moveMask(lessEqual(zero, maxDistance)) == 0)
+			continue;
+
+		const FloatV ox = load(&packet.originX[base]);
+		const FloatV oy = load(&packet.originY[base]);
+		const FloatV oz = load(&packet.originZ[base]);
+		const FloatV dx = load(&packet.directionX[base]);
+		const FloatV dy = load(&packet.directionY[base]);
+		const FloatV dz = load(&packet.directionZ[base]);
+		const FloatV a = add(add(mul(dx, dx), mul(dy, dy)), mul(dz, dz));
+		const FloatV scaledMin = mul(minV, a);
+		FloatV scaledMax = mul(maxDistance, a);
+
+		for (int slot = first; slot < first + count; slot++)
+		{
+			const FloatV cox = sub(ox, broadcast(x[slot]));
+			const FloatV coy = sub(oy, broadcast(y[slot]));
+			const FloatV coz = sub(oz, broadcast(z[slot]));
+			const float r = radius[slot];
+
+			const FloatV halfB = add(add(mul(cox, dx), mul(coy, dy)), mul(coz, dz));
+			const FloatV c = sub(add(add(mul(cox, cox), mul(coy, coy)), mul(coz, coz)), broadcast(r * r));
+			const FloatV discriminant = sub(mul(halfB, halfB), mul(a, c));
+			const FloatV scaledDistance = sub(sub(zero, halfB), sqrt(discriminant));
+
+			const FloatV ahead = bitAnd(lessEqual(zero, c), lessEqual(halfB, zero));
+			const FloatV blocks = bitAnd(bitAnd(lessThan(scaledMin, scaledDistance), lessThan(scaledDistance, scaledMax)), lessEqual(zero, discriminant));
+			const FloatV occluded = bitAnd(ahead, blocks);
+			if (moveMask(occluded) == 0)
+				continue;
+
+			maxDistance = select(occluded, inactive, maxDistance);
+			scaledMax = select(occluded, inactive, scaledMax);
+			if (moveMask(lessEqual(zero, maxDistance)) == 0)
+				break;
+		}
+
+		store(&packet.closest[base], maxDistance);
+		anyActive = anyActive || moveMask(lessEqual(zero, maxDistance)) != 0;
+	}
+
+	return !anyActive;
+}
+
+#else
+
+int SphereGeometry::intersectClosest(const Vector3& origin, const Vector3& direction, int first, int count,
+	float minDistance, float& closest) const
+{
+	const float a = direction * direction;
+	int closestSlot = -1;
+
+	for (int i = first; i < first + count; i++)
+	{
+		const Vector3 co = { origin.x - x[i], origin.y - y[i], origin.z - z[i] };
+		const float b = 2 * (co * direction);
+		const float c = co * co - radius[i] * radius[i];
+		const float discriminant = b * b - 4 * a * c;
+		if (discriminant < 0)
+			continue;
+
+		const float t = std::fabs(discriminant) < epsilon ? -b / (2 * a) : (-b - std::sqrt(discriminant)) / (2 * a);
+		if (t > minDistance && t < closest)
+		{
+			closest = t;
+			closestSlot = i;
+		}
+	}
+
+	return closestSlot;
+}
+
+bool SphereGeometry::occludes(const Vector3& origin, const Vector3& direction, int first, int count,
+	float minDistance, float maxDistance) const
+{
+	const float a = direction * direction;
+
+	for (int i = first; i < first + count; i++)
+	{
+		const Vector3 co = { origin.x - x[i], origin.y - y[i], origin.z - z[i] };
+		const float halfB = co * direction;
+		const float c = co * co - radius[i] * radius[i];
+
+		// only the near root counts, so an origin inside the sphere or a sphere behind the origin never blocks
+		if (c < 0 || halfB > 0)
+			continue;
+
+		const float discriminant = halfB * halfB - a * c;
+		if (discriminant < 0)
+			continue;
+
+		// near root scaled by a, compared against the scaled interval to skip the division
+		const float scaledDistance = -halfB - std::sqrt(discriminant);
+		if (scaledDistance > minDistance * a && scaledDistance < maxDistance * a)
+			return true;
+	}
+
+	return false;
+}
+
+
+void SphereGeometry::intersectPacket(const Vector3& origin, RayPacket& packet, int first, int count, float minDistance) const
+{
+	for (int lane = 0; lane < RayPacket::size; lane++)
+	{
+		const int slot = intersectClosest(origin, packet.getDirection(lane), first, count, minDistance, packet.closest[lane]);
+		if (slot >= 0)
+			packet.slots[lane] = slot;
+	}
+}
+
+
+void SphereGeometry::intersectPacket(QueuePacket& packet, int first, int count, float minDistance) const
+{
+	for (int lane = 0; lane < QueuePacket::size; lane++)
+	{
+		if (!packet.isActive(lane))
+			continue;
+
+		const Vector3 origin = { packet.originX[lane], packet.originY[lane], packet.originZ[lane] };
+		const Vector3 direction = { packet.directionX[lane], packet.directionY[lane], packet.directionZ[lane] };
+		const int slot = intersectClosest(origin, direction, first, count, minDistance, packet.closest[lane]);
+		if (slot >= 0)
+			packet.slots[lane] = slot;
+	}
+}
+
+bool SphereGeometry::occludesPacket(QueuePacket& packet, int first, int count, float minDistance) const
+{
+	bool anyActive = false;
+	for (int lane = 0; lane < QueuePacket::size; lane++)
+	{
+		if (!packet.isActive(lane))
+			continue;
+
+		const Vector3 origin = { packet.originX[lane], packet.originY[lane], packet.originZ[lane] };
+		const Vector3 direction = { packet.directionX[lane], packet.directionY[lane], packet.directionZ[lane] };
+		if (occludes(origin, direction, first, count, minDistance, packet.closest[lane]))
+			packet.closest[lane] = -1.0f;
+		else
+			anyActive = true;
+	}
+
+	return !anyActive;
+}
+
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+
+#include "QueuePacket.h"
+#include "RayPacket.h"
+#include "Simd.h"
+#include "Sphere.h"
+#include "Vector3.h"
+
+// structure-of-arrays copy of the sphere geometry (no material data) in BVH leaf order,
+// so a leaf is a contiguous run that the kernels test simdWidth spheres at a time
+class SphereGeometry
+{
+public:
+	static constexpr int simdWidth = Simd::width;
+
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+	std::vector<float> radius;
+
+	// slot i holds spheres[order[i]]; the arrays are padded so a full-width load from any slot stays in bounds
+	void build(const std::vector<Sphere>& spheres, const std::vector<int>& order);
+
+	// nearest root in (minDistance, closest) over slots [first, first + count), shrinks closest and returns the slot or -1
+	int intersectClosest(const Vector3& origin, const Vector3& direction, int first, int count, float minDistance, float& closest) const;
+	// true if any sphere in the slots has its near root in (minDistance, maxDistance)
+	bool occludes(const Vector3& origin, const Vector3& direction, int first, int count, float minDistance, float maxDistance) const;
+	// closest-hit test of every ray of a packet starting at origin against the slots, one vector of rays per sphere;
+	// shrinks packet.closest and records the slots of the new nearest hits
+	void intersectPacket(const Vector3& origin, RayPacket& packet, int first, int count, float minDistance) const;
+	// intersectPacket for rays with their own origins, inactive lanes keep their state
+	void intersectPacket(QueuePacket& packet, int first, int count, float minDistance) const;
+	// occludes for every active ray of the packet, one vector of rays per sphere; deactivates the occluded rays and
+	// returns true once no active ray is left
+	bool occludesPacket(QueuePacket& packet, int first, int count, float minDistance) const;
+};
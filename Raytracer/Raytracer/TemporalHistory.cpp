@@ -0,0 +1,124 @@
+#include "TemporalHistory.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	uint32_t floatBits(float value)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+
+	void atomicMin(std::atomic<uint64_t>& target, uint64_t value)
+	{
+		uint64_t current = target.load(std::memory_order_relaxed);
+		while (value < current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	// fixed per-pixel phase so the refreshed pixels are scattered over the frame instead of forming a pattern
+	uint32_t refreshPhase(uint32_t pixel)
+	{
+		return (pixel * 2654435761u) >> 16;
+	}
+}
+
+bool TemporalHistory::beginFrame(int newWidth, int newHeight, uint64_t sceneVersion)
+{
+	if (newWidth != width || newHeight != height)
+	{
+		width = newWidth;
+		height = newHeight;
+		const size_t pixelCount = static_cast<size_t>(width) * height;
+		previousSamples.assign(pixelCount, TemporalSample());
+		currentSamples.assign(pixelCount, TemporalSample());
+		reprojected.reset(new std::atomic<uint64_t>[pixelCount]);
+		valid = false;
+	}
+
+	if (sceneVersion != historySceneVersion)
+		valid = false;
+
+	return valid;
+}
+
+void TemporalHistory::reproject(const Camera& camera, float aspectRatio, float halfFovTan, ThreadPool& threadPool)
+{
+	const float scaleX = 0.5f * width / (aspectRatio * halfFovTan);
+	const float scaleY = 0.5f * height / halfFovTan;
+
+	threadPool.parallelFor(0, height, 16, [this](int y)
+	{
+		for (int x = 0; x < width; x++)
+			reprojected[static_cast<size_t>(y) * width + x].store(noSample, std::memory_order_relaxed);
+	});
+
+	threadPool.parallelFor(0, height, 16, [this, &camera, scaleX, scaleY](int y)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			const uint32_t source = static_cast<uint32_t>(y) * width + x;
+			const TemporalSample& sample = previousSamples[source];
+			const bool hit = sample.primitive >= 0;
+
+			// inverse of Raytracer::computePrimaryRayDirection; points at infinity only see the rotation
+			const Vector3 view = hit ? sample.point - camera.position : sample.point;
+			const float depth = view * camera.forward;
+			if (depth <= 0)
+				continue;
+
+			const float pixelX = std::floor(0.5f * width + (view * camera.right) / depth * scaleX);
+			const float pixelY = std::floor(0.5f * height - (view * camera.up) / depth * scaleY);
+			if (pixelX < 0 || pixelX >= width || pixelY < 0 || pixelY >= height)
+				continue;
+
+			const uint64_t packed = static_cast<uint64_t>(floatBits(hit ? depth : FLT_MAX)) << 32 | source;
+			atomicMin(reprojected[static_cast<size_t>(pixelY) * width + static_cast<size_t>(pixelX)], packed);
+		}
+	});
+}
+
+const TemporalSample* TemporalHistory::findReprojected(int x, int y) const
+{
+	const uint32_t pixel = static_cast<uint32_t>(y) * width + x;
+	if (!valid || (refreshPhase(pixel) + frameIndex) % refreshPeriod == 0)
+		return nullptr;
+
+	const TemporalSample* sample = findWinner(x, y);
+	if (!sample)
+		return nullptr;
+
+	// the winner lies up to a pixel away from this pixel's center and forward scattering leaves gaps along edges that
+	// move, so only pixels inside a region of the same primitive and the same lit lights count
+	const int neighbors[4][2] = { { x - 1, y }, { x + 1, y }, { x, y - 1 }, { x, y + 1 } };
+	for (const auto& neighbor : neighbors)
+	{
+		const TemporalSample* other = findWinner(neighbor[0], neighbor[1]);
+		if (!other || other->primitive != sample->primitive || other->lightVisibility != sample->lightVisibility)
+			return nullptr;
+	}
+
+	return sample;
+}
+
+const TemporalSample* TemporalHistory::findWinner(int x, int y) const
+{
+	if (x < 0 || x >= width || y < 0 || y >= height)
+		return nullptr;
+
+	const uint64_t packed = reprojected[static_cast<size_t>(y) * width + x].load(std::memory_order_relaxed);
+	return packed == noSample ? nullptr : &previousSamples[static_cast<uint32_t>(packed)];
+}
+
+void TemporalHistory::endFrame(uint64_t sceneVersion)
+{
+	previousSamples.swap(currentSamples);
+	historySceneVersion = sceneVersion;
+	valid = true;
+	frameIndex++;
+}
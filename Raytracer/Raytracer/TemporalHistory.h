@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Camera.h"
+#include "ThreadPool.h"
+#include "Vector3.h"
+
+class TemporalSample
+{
+public:
+	Vector3 point; // world-space hit position, or the ray direction for background samples at infinity
+	int primitive = -1; // -1 for background
+	uint32_t lightVisibility = 0; // bit i is set if light i was unoccluded from point
+};
+
+// per-pixel samples of the previous frame; before a frame they are forward-scattered into the new camera so pixels
+// inside a region that showed one primitive under the same lights can skip the primary ray and the shadow rays
+class TemporalHistory
+{
+public:
+	static constexpr uint32_t refreshPeriod = 8; // every pixel is retraced at least once every refreshPeriod frames
+	static constexpr int maxLights = 32; // bits of TemporalSample::lightVisibility, scenes with more lights are not reused
+
+	// returns false and drops the history if the frame size or the scene changed since the last frame
+	bool beginFrame(int width, int height, uint64_t sceneVersion);
+	void invalidate() { valid = false; }
+	// scatters every previous sample into the pixel it projects to, the nearest sample wins a pixel
+	void reproject(const Camera& camera, float aspectRatio, float halfFovTan, ThreadPool& threadPool);
+	// previous sample that landed on pixel (x, y), nullptr if the pixel is due for a refresh or if it or one of its four
+	// neighbors received no sample, a sample of another primitive (disocclusions and silhouettes) or one lit by other
+	// lights (shadow edges)
+	const TemporalSample* findReprojected(int x, int y) const;
+	// records the current frame's sample of pixel (x, y)
+	void store(int x, int y, const TemporalSample& sample) { currentSamples[static_cast<size_t>(y) * width + x] = sample; }
+	// makes the stored samples the history of the next frame
+	void endFrame(uint64_t sceneVersion);
+
+private:
+	static constexpr uint64_t noSample = ~0ull;
+
+	int width = 0;
+	int height = 0;
+	bool valid = false;
+	uint64_t historySceneVersion = 0;
+	uint32_t frameIndex = 0;
+	std::vector<TemporalSample> previousSamples;
+	std::vector<TemporalSample> currentSamples;
+	// per pixel: depth bits in the high half and the source pixel index in the low half, so an atomic min keeps the nearest
+	std::unique_ptr<std::atomic<uint64_t>[]> reprojected;
+
+	const TemporalSample* findWinner(int x, int y) const;
+};
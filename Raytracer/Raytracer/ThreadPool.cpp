@@ -1,42 +1,287 @@
 #include "ThreadPool.h"
 
 #include <iostream>
+#include <string>
 
-ThreadPool::ThreadPool(size_t numThreads): numThreads(numThreads), stop(false)
+#include "Profiler.h"
+
+namespace
 {
-	std::cout << "Number of threads spawned: " << numThreads << std::endl;
-	for (size_t i = 0; i < numThreads; ++i)
+	// index of the calling thread in the pool it belongs to, -1 for threads outside any pool
+	thread_local int workerIndex = -1;
+	thread_local const ThreadPool* workerPool = nullptr;
+
+	uint32_t nextRandom(uint32_t& state)
 	{
-		threads.emplace_back([this]
-		{
-			while (true)
-			{
-				std::function<void()> task;
-				{
-					std::unique_lock<std::mutex> lock(queueMutex);
-					condition.wait(lock, [this] { return stop || !tasks.empty(); });
+		// xorshift32
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+}
 
-					if (stop && tasks.empty())
-						return;
+bool WorkStealingDeque::push(Task* task)
+{
+	const int64_t b = bottom.load(std::memory_order_relaxed);
+	const int64_t t = top.load(std::memory_order_acquire);
+	if (b - t >= capacity)
+		return false;
+
+	buffer[b & (capacity - 1)].store(task, std::memory_order_release);
+	std::atomic_thread_fence(std::memory_order_release);
+	bottom.store(b + 1, std::memory_order_relaxed);
+	return true;
+}
 
-					task = std::move(tasks.front());
-					tasks.pop();
-				}
+Task* WorkStealingDeque::pop()
+{
+	const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t t = top.load(std::memory_order_relaxed);
 
-				task();
-			}
-		});
+	if (t > b)
+	{
+		// already empty
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	Task* task = buffer[b & (capacity - 1)].load(std::memory_order_relaxed);
+	if (t == b)
+	{
+		// last element, race the thieves for it
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			task = nullptr;
+
+		bottom.store(b + 1, std::memory_order_relaxed);
+	}
+
+	return task;
+}
+
+Task* WorkStealingDeque::steal()
+{
+	int64_t t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	const int64_t b = bottom.load(std::memory_order_acquire);
+	if (t >= b)
+		return nullptr;
+
+	Task* task = buffer[t & (capacity - 1)].load(std::memory_order_acquire);
+	if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		return nullptr;
+
+	return task;
+}
+
+bool WorkStealingDeque::empty() const
+{
+	return top.load(std::memory_order_acquire) >= bottom.load(std::memory_order_acquire);
+}
+
+ThreadPool::ThreadPool(size_t numThreads): numThreads(numThreads), stop(false), deques(new WorkStealingDeque[numThreads])
+{
+	std::cout << "Number of threads spawned: " << numThreads << std::endl;
+	for (size_t i = 0; i < numThreads; ++i)
+	{
+		threads.emplace_back([this, i] { workerLoop(static_cast<int>(i)); });
 	}
 }
 
 ThreadPool::~ThreadPool()
 {
 	{
-		std::unique_lock<std::mutex> lock(queueMutex);
+		std::unique_lock<std::mutex> lock(sleepMutex);
 		stop = true;
+		wakeEpoch++;
 	}
 
-	condition.notify_all();
+	sleepCondition.notify_all();
 	for (std::thread& thread : threads)
 		thread.join();
-}
\ No newline at end of file
+}
+
+void ThreadPool::spawn(Task& task, int copies)
+{
+	if (task.group)
+		task.group->pending.fetch_add(copies, std::memory_order_relaxed);
+
+	int injected = 0;
+	if (workerPool == this)
+	{
+		// a full deque spills over into the injection queue
+		WorkStealingDeque& deque = deques[workerIndex];
+		while (injected < copies && deque.push(&task))
+			injected++;
+	}
+
+	if (injected < copies)
+	{
+		std::unique_lock<std::mutex> lock(injectionMutex);
+		for (int i = injected; i < copies; i++)
+			injectionQueue.push_back(&task);
+
+		injectedCount.store(static_cast<int>(injectionQueue.size()), std::memory_order_relaxed);
+	}
+
+	wakeWorkers(copies);
+}
+
+void ThreadPool::wait(TaskGroup& group)
+{
+	const int index = workerPool == this ? workerIndex : -1;
+	uint32_t randomState = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&group)) | 1;
+
+	while (group.pending.load(std::memory_order_acquire) > 0)
+	{
+		if (Task* task = findTask(index, randomState))
+		{
+			execute(task);
+			continue;
+		}
+
+		// the remaining tasks run on other threads: sleep with the idle workers until a spawn brings work to help with
+		// or the last task of the group finishes, with the same announce and re-check as workerLoop
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		const uint64_t epoch = wakeEpoch;
+		sleepingCount.fetch_add(1, std::memory_order_seq_cst);
+
+		if (group.pending.load(std::memory_order_seq_cst) > 0 && !hasVisibleWork())
+			sleepCondition.wait(lock, [this, epoch] { return wakeEpoch != epoch; });
+
+		sleepingCount.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
+
+void ThreadPool::execute(Task* task)
+{
+	// the group may be destroyed as soon as the counter drops, so it is read before running and never touched after
+	TaskGroup* group = task->group;
+	{
+		PROFILE_SCOPE("task");
+		task->function(task->context);
+	}
+
+	// the last task wakes every sleeper since its waiter may be among them; notifying on the group itself could touch
+	// it after it is gone
+	if (group && group->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		wakeWorkers(static_cast<int>(numThreads) + 1);
+}
+
+void ThreadPool::workerLoop(int index)
+{
+	workerIndex = index;
+	workerPool = this;
+	Profiler::setThreadName("worker " + std::to_string(index));
+	uint32_t randomState = 2463534242u + static_cast<uint32_t>(index) * 2654435761u;
+
+	while (true)
+	{
+		Task* task = nullptr;
+		for (int spin = 0; spin < spinCount && !task; spin++)
+		{
+			task = findTask(index, randomState);
+			if (!task)
+				std::this_thread::yield();
+		}
+
+		if (task)
+		{
+			execute(task);
+			continue;
+		}
+
+		// park: announce the sleeper first, then re-check so a concurrent spawn either sees us or we see its task
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		const uint64_t epoch = wakeEpoch;
+		sleepingCount.fetch_add(1, std::memory_order_seq_cst);
+
+		if (stop && !hasVisibleWork())
+		{
+			sleepingCount.fetch_sub(1, std::memory_order_relaxed);
+			return;
+		}
+
+		if (!hasVisibleWork())
+			sleepCondition.wait(lock, [this, epoch] { return stop || wakeEpoch != epoch; });
+
+		sleepingCount.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
+
+Task* ThreadPool::findTask(int index, uint32_t& randomState)
+{
+	if (index >= 0)
+	{
+		if (Task* task = deques[index].pop())
+			return task;
+	}
+
+	if (Task* task = popInjected())
+		return task;
+
+	if (numThreads == 0)
+		return nullptr;
+
+	// steal from the top of a random victim, walking the others from there
+	const int start = static_cast<int>(nextRandom(randomState) % numThreads);
+	for (size_t i = 0; i < numThreads; i++)
+	{
+		const int victim = static_cast<int>((start + i) % numThreads);
+		if (victim == index)
+			continue;
+
+		if (Task* task = deques[victim].steal())
+			return task;
+	}
+
+	return nullptr;
+}
+
+Task* ThreadPool::popInjected()
+{
+	if (injectedCount.load(std::memory_order_relaxed) == 0)
+		return nullptr;
+
+	std::unique_lock<std::mutex> lock(injectionMutex);
+	if (injectionQueue.empty())
+		return nullptr;
+
+	Task* task = injectionQueue.front();
+	injectionQueue.pop_front();
+	injectedCount.store(static_cast<int>(injectionQueue.size()), std::memory_order_relaxed);
+	return task;
+}
+
+bool ThreadPool::hasVisibleWork() const
+{
+	if (injectedCount.load(std::memory_order_seq_cst) > 0)
+		return true;
+
+	for (size_t i = 0; i < numThreads; i++)
+	{
+		if (!deques[i].empty())
+			return true;
+	}
+
+	return false;
+}
+
+void ThreadPool::wakeWorkers(int count)
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (sleepingCount.load(std::memory_order_seq_cst) == 0)
+		return;
+
+	{
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wakeEpoch++;
+	}
+
+	if (count == 1)
+		sleepCondition.notify_one();
+	else
+		sleepCondition.notify_all();
+}
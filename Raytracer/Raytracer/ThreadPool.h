@@ -1,12 +1,47 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <vector>
-#include <queue>
+#include <deque>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
-#include <functional>
-#include <future>
+#include <memory>
+
+// counts the spawned tasks of a fork/join region that have not finished yet
+class TaskGroup
+{
+public:
+	std::atomic<int> pending = 0;
+};
+
+// caller-owned unit of work, the pool never copies or frees it; spawning the same task several times runs it once per spawn
+class Task
+{
+public:
+	void (*function)(void* context) = nullptr;
+	void* context = nullptr;
+	TaskGroup* group = nullptr;
+};
+
+// Chase-Lev deque: the owning worker pushes and pops at the bottom, thieves steal from the top
+class WorkStealingDeque
+{
+public:
+	static constexpr int64_t capacity = 1024;
+
+	bool push(Task* task);
+	Task* pop();
+	Task* steal();
+	bool empty() const;
+
+private:
+	std::atomic<int64_t> top = 0;
+	std::atomic<int64_t> bottom = 0;
+	std::atomic<Task*> buffer[capacity];
+};
 
 class ThreadPool
 {
@@ -19,34 +54,80 @@ public:
 	const ThreadPool& operator=(const ThreadPool&) = delete;
 	const ThreadPool& operator=(ThreadPool&&) = delete;
 
-	template<typename F, class... Args>
-	std::future<std::invoke_result_t<F, Args...>> enqueue(F&& f, Args&&... args)
+	size_t size() const { return numThreads; }
+
+	// wraps a callable that outlives the task (usually a lambda on the spawning stack frame) without allocating
+	template<typename F>
+	static Task makeTask(F& callable, TaskGroup& group)
 	{
-		using returnType = std::invoke_result_t<F, Args...>;
+		return { [](void* context) { (*static_cast<F*>(context))(); }, &callable, &group };
+	}
 
-		auto task = std::make_shared<std::packaged_task<returnType()>>(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
-		std::future<returnType> result = task->get_future();
+	// pushes the task onto the calling worker's deque, or onto the shared injection queue from other threads
+	void spawn(Task& task, int copies = 1);
+	// runs pending tasks on the calling thread until every task spawned into the group has finished, sleeping while
+	// there are none to run
+	void wait(TaskGroup& group);
+
+	// calls fn(i) for every i in [begin, end); workers and the calling thread claim grain-sized chunks from a shared counter
+	// and the call returns once a single task group has drained, without allocating
+	template<typename F>
+	void parallelFor(int begin, int end, int grain, F&& fn)
+	{
+		if (begin >= end)
+			return;
 
+		grain = std::max(grain, 1);
+		std::atomic<int> next = begin;
+		auto runChunks = [&]
 		{
-			std::unique_lock<std::mutex> lock(queueMutex);
+			while (true)
+			{
+				const int chunkBegin = next.fetch_add(grain, std::memory_order_relaxed);
+				if (chunkBegin >= end)
+					return;
 
-			if (stop)
-				throw std::runtime_error("enqueue on stopped ThreadPool");
+				const int chunkEnd = std::min(chunkBegin + grain, end);
+				for (int i = chunkBegin; i < chunkEnd; i++)
+					fn(i);
+			}
+		};
 
-			tasks.emplace([task]() { (*task)(); });
-		}
+		const int chunkCount = (end - begin + grain - 1) / grain;
+		const int helperCount = std::min(static_cast<int>(numThreads), chunkCount - 1);
 
-		condition.notify_one();
-		return result;
+		TaskGroup group;
+		Task task = makeTask(runChunks, group);
+		if (helperCount > 0)
+			spawn(task, helperCount);
+
+		runChunks();
+		wait(group);
 	}
 
 private:
+	static constexpr int spinCount = 64;
+
 	size_t numThreads;
-	bool stop;
+	std::atomic<bool> stop;
 
 	std::vector<std::thread> threads;
-	std::queue<std::function<void()>> tasks;
+	std::unique_ptr<WorkStealingDeque[]> deques;
+
+	std::mutex injectionMutex;
+	std::deque<Task*> injectionQueue;
+	std::atomic<int> injectedCount = 0;
+
+	std::mutex sleepMutex;
+	std::condition_variable sleepCondition;
+	std::atomic<int> sleepingCount = 0;
+	uint64_t wakeEpoch = 0;
+
+	void execute(Task* task);
 
-	std::mutex queueMutex;
-	std::condition_variable condition;
-};
\ No newline at end of file
+	void workerLoop(int index);
+	Task* findTask(int index, uint32_t& randomState);
+	Task* popInjected();
+	bool hasVisibleWork() const;
+	void wakeWorkers(int count);
+};
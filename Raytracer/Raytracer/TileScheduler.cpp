@@ -0,0 +1,69 @@
+#include "TileScheduler.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace
+{
+	// spreads the lower 16 bits of value to the even bit positions
+	uint32_t spreadBits(uint32_t value)
+	{
+		value &= 0x0000ffff;
+		value = (value | (value << 8)) & 0x00ff00ff;
+		value = (value | (value << 4)) & 0x0f0f0f0f;
+		value = (value | (value << 2)) & 0x33333333;
+		value = (value | (value << 1)) & 0x55555555;
+		return value;
+	}
+
+	uint32_t mortonCode(uint32_t x, uint32_t y)
+	{
+		return spreadBits(x) | (spreadBits(y) << 1);
+	}
+}
+
+TileScheduler::TileScheduler(int tileSize): tileSize(tileSize)
+{
+}
+
+void TileScheduler::setTileSize(int newTileSize)
+{
+	if (newTileSize == tileSize || newTileSize <= 0)
+		return;
+
+	tileSize = newTileSize;
+	buildTiles();
+}
+
+void TileScheduler::beginFrame(int frameWidth, int frameHeight)
+{
+	if (frameWidth != width || frameHeight != height)
+	{
+		width = frameWidth;
+		height = frameHeight;
+		buildTiles();
+	}
+}
+
+void TileScheduler::buildTiles()
+{
+	tiles.clear();
+	const int tilesX = (width + tileSize - 1) / tileSize;
+	const int tilesY = (height + tileSize - 1) / tileSize;
+	tiles.reserve(static_cast<size_t>(tilesX) * tilesY);
+
+	for (int ty = 0; ty < tilesY; ty++)
+	{
+		for (int tx = 0; tx < tilesX; tx++)
+		{
+			const int x0 = tx * tileSize;
+			const int y0 = ty * tileSize;
+			tiles.push_back({ x0, y0, std::min(x0 + tileSize, width), std::min(y0 + tileSize, height) });
+		}
+	}
+
+	std::sort(tiles.begin(), tiles.end(), [this](const Tile& a, const Tile& b)
+	{
+		return mortonCode(a.x0 / tileSize, a.y0 / tileSize) < mortonCode(b.x0 / tileSize, b.y0 / tileSize);
+	});
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+
+class Tile
+{
+public:
+	int x0, y0; // inclusive
+	int x1, y1; // exclusive
+};
+
+// splits the frame into square tiles stored in Morton (Z-order) so consecutive tile indices are spatially close
+class TileScheduler
+{
+public:
+	explicit TileScheduler(int tileSize);
+
+	void setTileSize(int newTileSize);
+	int getTileSize() const { return tileSize; }
+
+	// rebuilds the tile list if the frame size changed
+	void beginFrame(int frameWidth, int frameHeight);
+	int getTileCount() const { return static_cast<int>(tiles.size()); }
+	const Tile& getTile(int index) const { return tiles[index]; }
+
+private:
+	int tileSize;
+	int width = 0;
+	int height = 0;
+	std::vector<Tile> tiles;
+
+	void buildTiles();
+};
@@ -0,0 +1,114 @@
+#include "ToneMapper.h"
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define RAYTRACER_TONEMAP_SSE
+#endif
+
+static_assert(sizeof(FloatColor) == 16, "map reads one color per 128-bit vector");
+static_assert(sizeof(Color) == 4, "map writes four colors per 128-bit vector");
+
+void ToneMapper::setGamma(float value)
+{
+	gamma = value;
+	gammaTable.clear();
+	if (gamma == 1.0f)
+		return;
+
+	gammaTable.resize(gammaTableSize);
+	for (int i = 0; i < gammaTableSize; i++)
+	{
+		const float encoded = std::pow(static_cast<float>(i) / (gammaTableSize - 1), 1.0f / gamma);
+		gammaTable[i] = static_cast<uint8_t>(encoded * 255.0f + 0.5f);
+	}
+}
+
+// exposure and operator, result in [0, 1]; written so that NaN ends up as black like the vector path
+float ToneMapper::mapChannel(float value) const
+{
+	value *= exposure;
+	if (!(value > 0.0f))
+		return 0.0f;
+
+	if (toneMapOperator == ToneMapOperator::Reinhard)
+		return value / (1.0f + value);
+
+	return value < 1.0f ? value : 1.0f;
+}
+
+uint8_t ToneMapper::quantize(float value) const
+{
+	if (gammaTable.empty())
+		return static_cast<uint8_t>(value * 255.0f + 0.5f);
+
+	return gammaTable[static_cast<int>(value * (gammaTableSize - 1) + 0.5f)];
+}
+
+void ToneMapper::map(const FloatColor* colors, int count, Color* out) const
+{
+	int i = 0;
+
+#if defined(RAYTRACER_TONEMAP_SSE)
+	const __m128 exposureV = _mm_set1_ps(exposure);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128i rgbMask = _mm_set1_epi32(0x00FFFFFF);
+
+	if (toneMapOperator == ToneMapOperator::Clamp && gammaTable.empty())
+	{
+		// the default path: the saturating packs clamp below 0 and above 255 for free, only values too large for the
+		// conversion are limited first; the limit comes first in the min so NaN converts to 0 like a negative value
+		const __m128 scale = _mm_set1_ps(255.0f);
+		const __m128 limit = _mm_set1_ps(255.5f);
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i quantized[4];
+			for (int pixel = 0; pixel < 4; pixel++)
+			{
+				const __m128 value = _mm_mul_ps(_mm_loadu_ps(&colors[i + pixel].r), exposureV);
+				quantized[pixel] = _mm_cvttps_epi32(_mm_min_ps(limit, _mm_add_ps(_mm_mul_ps(value, scale), half)));
+			}
+
+			const __m128i low = _mm_packs_epi32(quantized[0], quantized[1]);
+			const __m128i high = _mm_packs_epi32(quantized[2], quantized[3]);
+			const __m128i bytes = _mm_and_si128(_mm_packus_epi16(low, high), rgbMask);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), bytes);
+		}
+	}
+	else
+	{
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 scale = _mm_set1_ps(gammaTable.empty() ? 255.0f : static_cast<float>(gammaTableSize - 1));
+		const bool reinhard = toneMapOperator == ToneMapOperator::Reinhard;
+		for (; i + 4 <= count; i += 4)
+		{
+			// one pixel per vector, so the four channels of a pixel share every operation
+			alignas(16) int32_t indices[16];
+			for (int pixel = 0; pixel < 4; pixel++)
+			{
+				// max with the value first turns NaN into 0
+				__m128 value = _mm_max_ps(_mm_mul_ps(_mm_loadu_ps(&colors[i + pixel].r), exposureV), zero);
+				value = reinhard ? _mm_div_ps(value, _mm_add_ps(one, value)) : _mm_min_ps(value, one);
+				const __m128i quantized = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(value, scale), half));
+				_mm_store_si128(reinterpret_cast<__m128i*>(indices + pixel * 4), quantized);
+			}
+
+			for (int pixel = 0; pixel < 4; pixel++)
+			{
+				const int32_t* index = indices + pixel * 4;
+				out[i + pixel] = gammaTable.empty()
+					? Color{ static_cast<uint8_t>(index[0]), static_cast<uint8_t>(index[1]), static_cast<uint8_t>(index[2]), 0 }
+					: Color{ gammaTable[index[0]], gammaTable[index[1]], gammaTable[index[2]], 0 };
+			}
+		}
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		const FloatColor& color = colors[i];
+		out[i] = { quantize(mapChannel(color.r)), quantize(mapChannel(color.g)), quantize(mapChannel(color.b)), 0 };
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Color.h"
+#include "FloatColor.h"
+
+enum class ToneMapOperator
+{
+	Clamp, // everything above white saturates, the look of the former 8-bit pipeline
+	Reinhard, // x / (1 + x), rolls highlights off instead of clipping them
+};
+
+// last stage of every frame: scales the float colors of the shading pipeline by the exposure, applies the tone mapping
+// operator and the gamma encoding and quantizes to 8 bits; the defaults (exposure 1, Clamp, gamma 1) round the linear
+// colors like Image did before, so they keep the current look
+class ToneMapper
+{
+public:
+	void setExposure(float value) { exposure = value; }
+	float getExposure() const { return exposure; }
+	void setOperator(ToneMapOperator value) { toneMapOperator = value; }
+	ToneMapOperator getOperator() const { return toneMapOperator; }
+	// output is the tone mapped value raised to 1 / gamma, looked up in a table unless gamma is 1
+	void setGamma(float value);
+	float getGamma() const { return gamma; }
+
+	// maps count colors to out four at a time with SSE2, the rest one at a time; alpha is always 0
+	void map(const FloatColor* colors, int count, Color* out) const;
+
+private:
+	static constexpr int gammaTableSize = 1 << 14; // entries over [0, 1], a step near black is below 3 levels at gamma 2.2
+
+	float exposure = 1.0f;
+	ToneMapOperator toneMapOperator = ToneMapOperator::Clamp;
+	float gamma = 1.0f;
+	std::vector<uint8_t> gammaTable; // empty while gamma is 1
+
+	float mapChannel(float value) const;
+	uint8_t quantize(float value) const;
+};
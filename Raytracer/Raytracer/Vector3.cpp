@@ -50,3 +50,8 @@ Vector3 Vector3::operator-() const
 {
 	return { -x, -y, -z };
 }
+
+float Vector3::operator[](int axis) const
+{
+	return axis == 0 ? x : axis == 1 ? y : z;
+}
@@ -15,4 +15,5 @@ public:
 	Vector3 normalized() const;
 	float length() const;
 	Vector3 operator-() const;
+	float operator[](int axis) const;
 };
\ No newline at end of file
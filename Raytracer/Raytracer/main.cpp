@@ -1,14 +1,26 @@
 ﻿#include <iostream>
 
 #include <SDL.h>
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
 
 #include "CameraController.h"
+#include "Headless.h"
+#include "Profiler.h"
 #include "Raytracer.h"
+#include "ResolutionController.h"
 
 #undef main
 
-int init(SDL_Window*& window, SDL_Renderer*& renderer, SDL_Surface*& surface, SDL_Texture*& texture, int windowWidth, int windowHeight)
+// the tracer writes straight into the locked memory of this streaming texture, so frames need no staging surface or upload copy
+constexpr Uint32 texturePixelFormat = SDL_PIXELFORMAT_RGB888;
+// one texture is traced into by the workers while the main thread presents the other
+constexpr int frameBufferCount = 2;
+
+int init(SDL_Window*& window, SDL_Renderer*& renderer, SDL_Texture* textures[frameBufferCount], int windowWidth, int windowHeight)
 {
 	window = SDL_CreateWindow("Raytracer", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, windowWidth, windowHeight, SDL_WINDOW_SHOWN);
 	if (!window)
@@ -27,28 +39,82 @@ int init(SDL_Window*& window, SDL_Renderer*& renderer, SDL_Surface*& surface, SD
 		return 1;
 	}
 
-	surface = SDL_CreateRGBSurface(0, windowWidth, windowHeight, 32, 0, 0, 0, 0);
-	if (!surface)
+	// the traced image can be smaller than the window, bilinear filtering scales it up on the GPU
+	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1");
+	for (int i = 0; i < frameBufferCount; i++)
 	{
-		std::cerr << "SDL_CreateRGBSurface Error: " << SDL_GetError() << std::endl;
-		SDL_DestroyRenderer(renderer);
-		SDL_DestroyWindow(window);
-		SDL_Quit();
-		return 1;
+		textures[i] = SDL_CreateTexture(renderer, texturePixelFormat, SDL_TEXTUREACCESS_STREAMING, windowWidth, windowHeight);
+		if (!textures[i])
+		{
+			std::cerr << "SDL_CreateTexture Error: " << SDL_GetError() << std::endl;
+			for (int j = 0; j < i; j++)
+				SDL_DestroyTexture(textures[j]);
+			SDL_DestroyRenderer(renderer);
+			SDL_DestroyWindow(window);
+			SDL_Quit();
+			return 1;
+		}
 	}
 
-	texture = SDL_CreateTextureFromSurface(renderer, surface);
-	if (!texture)
+	return 0;
+}
+
+// channel positions of an SDL pixel format, resolved once at startup instead of per pixel
+PixelLayout createPixelLayout(Uint32 pixelFormat)
+{
+	PixelLayout layout;
+	SDL_PixelFormat* format = SDL_AllocFormat(pixelFormat);
+	if (!format)
+		return layout;
+
+	layout.redShift = format->Rshift;
+	layout.greenShift = format->Gshift;
+	layout.blueShift = format->Bshift;
+	layout.alphaShift = format->Ashift;
+	layout.alphaMask = format->Amask;
+	SDL_FreeFormat(format);
+	return layout;
+}
+
+// locks the top-left width x height region of the texture and describes it to the tracer, the memory is write-only
+// and its pitch may be wider than a row; only the locked region is uploaded on unlock. one extra column and row are
+// locked when the region is smaller than the texture so duplicateFramebufferEdges can fill them
+bool lockFramebuffer(SDL_Texture* texture, const PixelLayout& layout, int width, int height, Framebuffer& framebuffer)
+{
+	PROFILE_SCOPE("SDL_LockTexture");
+	int textureWidth = 0;
+	int textureHeight = 0;
+	SDL_QueryTexture(texture, nullptr, nullptr, &textureWidth, &textureHeight);
+	const SDL_Rect region = { 0, 0, std::min(width + 1, textureWidth), std::min(height + 1, textureHeight) };
+	if (SDL_LockTexture(texture, &region, &framebuffer.pixels, &framebuffer.pitch) != 0)
 	{
-		std::cerr << "SDL_CreateTextureFromSurface Error: " << SDL_GetError() << std::endl;
-		SDL_FreeSurface(surface);
-		SDL_DestroyRenderer(renderer);
-		SDL_DestroyWindow(window);
-		SDL_Quit();
-		return 1;
+		std::cerr << "SDL_LockTexture Error: " << SDL_GetError() << std::endl;
+		return false;
 	}
 
-	return 0;
+	framebuffer.width = width;
+	framebuffer.height = height;
+	framebuffer.layout = layout;
+	return true;
+}
+
+// bilinear filtering of a sub-rect reads one texel past its right and bottom edges, so copy the last traced column
+// and row into the locked texels beyond them; otherwise a stale frame of another size bleeds into the edges
+void duplicateFramebufferEdges(SDL_Texture* texture, const Framebuffer& framebuffer)
+{
+	int textureWidth = 0;
+	int textureHeight = 0;
+	SDL_QueryTexture(texture, nullptr, nullptr, &textureWidth, &textureHeight);
+	const bool padColumn = framebuffer.width < textureWidth;
+	if (padColumn)
+		for (int y = 0; y < framebuffer.height; y++)
+		{
+			uint32_t* row = framebuffer.getRow(y);
+			row[framebuffer.width] = row[framebuffer.width - 1];
+		}
+	if (framebuffer.height < textureHeight)
+		std::memcpy(framebuffer.getRow(framebuffer.height), framebuffer.getRow(framebuffer.height - 1),
+			(framebuffer.width + (padColumn ? 1 : 0)) * sizeof(uint32_t));
 }
 
 void computeKeyboardInput(const CameraController& cameraController, float speed, float deltaTimeSec)
@@ -80,6 +146,41 @@ void computeKeyboardInput(const CameraController& cameraController, float speed,
 	}
 }
 
+// value following name on the command line, nullptr if the option is not given
+const char* findOption(int argc, char* argv[], const char* name)
+{
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (std::strcmp(argv[i], name) == 0)
+			return argv[i + 1];
+	}
+
+	return nullptr;
+}
+
+// H steps through shaded, time heatmap and ray count heatmap; the latter is skipped when the ray counters are compiled
+// out since it would stay black
+void cycleRenderMode(Raytracer& raytracer)
+{
+	switch (raytracer.getRenderMode())
+	{
+	case RenderMode::Shaded:
+		raytracer.setRenderMode(RenderMode::TimeHeatmap);
+		std::cout << "Render mode: time per pixel heatmap" << std::endl;
+		break;
+#if RAYTRACER_ENABLE_STATS
+	case RenderMode::TimeHeatmap:
+		raytracer.setRenderMode(RenderMode::RayHeatmap);
+		std::cout << "Render mode: rays per pixel heatmap" << std::endl;
+		break;
+#endif
+	default:
+		raytracer.setRenderMode(RenderMode::Shaded);
+		std::cout << "Render mode: shaded" << std::endl;
+		break;
+	}
+}
+
 void computeMouseMovement(Camera& camera, const SDL_Event& event, float sensitivity, float deltaTimeSec)
 {
 	const float deltaYaw = -event.motion.xrel * sensitivity * deltaTimeSec;
@@ -87,8 +188,17 @@ void computeMouseMovement(Camera& camera, const SDL_Event& event, float sensitiv
 	camera.rotate(deltaYaw, deltaPitch);
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+	if (isHeadlessRequested(argc, argv))
+	{
+		HeadlessOptions options;
+		if (!parseHeadlessOptions(argc, argv, options))
+			return 1;
+
+		return runHeadless(options);
+	}
+
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS) < 0)
 	{
 		std::cout << "SDL_Init Error: " << SDL_GetError() << std::endl;
@@ -100,14 +210,21 @@ int main()
 
 	SDL_Window* window = nullptr;
 	SDL_Renderer* renderer = nullptr;
-	SDL_Surface* surface = nullptr;
-	SDL_Texture* texture = nullptr;
-	if (init(window, renderer, surface, texture, windowWidth, windowHeight) != 0)
+	SDL_Texture* textures[frameBufferCount] = {};
+	if (init(window, renderer, textures, windowWidth, windowHeight) != 0)
 	{
 		std::cerr << "Failed to initialize SDL" << std::endl;
 		return 1;
 	}
 
+	const char* traceOption = findOption(argc, argv, "--trace");
+	const std::string tracePath = traceOption ? traceOption : "";
+	if (!tracePath.empty())
+	{
+		Profiler::setThreadName("main");
+		Profiler::start();
+	}
+
 	Camera camera;
 	const CameraController cameraController(camera, 0.02f);
 
@@ -116,57 +233,209 @@ int main()
 
 	constexpr float minDistance = 0.01f;
 	constexpr float maxDistance = std::numeric_limits<float>::max();
-	const float aspectRatio = static_cast<float>(surface->w) / surface->h;
+	const float aspectRatio = static_cast<float>(windowWidth) / windowHeight;
 	constexpr float fov = 45.f; // field of View in degrees
 	Raytracer raytracer(camera, minDistance, maxDistance, aspectRatio, fov);
+	const PixelLayout layout = createPixelLayout(texturePixelFormat);
 
 	constexpr int FPS = 60; // default FPS
 	constexpr int frameDelay = 1000 / FPS; // delay in ms per frame to achieve the target FPS
 
+	// tracing time budget for dynamic resolution, --frame-budget 0 always traces at window resolution
+	const char* budgetOption = findOption(argc, argv, "--frame-budget");
+	ResolutionController resolution(budgetOption ? std::atof(budgetOption) : frameDelay);
+
 	SDL_Event event;
 	bool running = true;
 	Uint32 frameStart;
 	int frameTime = 0;
 
+#if RAYTRACER_ENABLE_STATS
+	constexpr Uint64 statsInterval = 500; // ms between ray statistics updates in the window title
+	Uint64 lastStatsUpdate = 0;
+#endif
+
 	SDL_SetHintWithPriority(SDL_HINT_MOUSE_RELATIVE_MODE_WARP, "1", SDL_HINT_OVERRIDE);
 	SDL_SetRelativeMouseMode(SDL_TRUE);
 
+	// pipeline: frame N+1 is dispatched to the workers with the camera as it is at dispatch, then the main thread
+	// presents frame N while they trace; settings that the tracer reads are only changed between frames
+	bool renderModeRequested = false;
+	bool progressiveRequested = false;
+	bool adaptiveRequested = false;
+	bool temporalRequested = false;
+	bool wavefrontRequested = false;
+	bool toneMapRequested = false;
+	int tracedTexture = 0;
+	bool tracing = false;
+	SDL_Rect tracedRegions[frameBufferCount] = {};
+
+	// progressive refinement keeps moving frames cheap on its own, so dynamic resolution only runs without it; both
+	// start disabled so the dynamic resolution and the G, T and B modes apply until P is pressed
+	const auto computeRenderSize = [&](SDL_Rect& region)
+	{
+		if (raytracer.isProgressive())
+		{
+			region.w = windowWidth;
+			region.h = windowHeight;
+		}
+		else
+			resolution.getRenderSize(windowWidth, windowHeight, region.w, region.h);
+	};
+
+	Framebuffer framebuffer;
+	computeRenderSize(tracedRegions[tracedTexture]);
+	if (lockFramebuffer(textures[tracedTexture], layout, tracedRegions[tracedTexture].w, tracedRegions[tracedTexture].h, framebuffer))
+	{
+		raytracer.beginRender(framebuffer);
+		tracing = true;
+	}
+
 	float deltaTimeSec = 0;
-	while (running)
+	while (running && tracing)
 	{
 		frameStart = SDL_GetTicks64();
+		PROFILE_SCOPE("frame");
 
-		while (SDL_PollEvent(&event) != 0)
 		{
-			switch (event.type)
-			{
-			case SDL_QUIT:
-			{
-				running = false;
-				break;
-			}
-			case SDL_MOUSEMOTION:
+			PROFILE_SCOPE("input");
+			while (SDL_PollEvent(&event) != 0)
 			{
-				computeMouseMovement(camera, event, sensitivity, deltaTimeSec);
-				break;
-			}
-			default:
-				break;
+				switch (event.type)
+				{
+				case SDL_QUIT:
+				{
+					running = false;
+					break;
+				}
+				case SDL_MOUSEMOTION:
+				{
+					computeMouseMovement(camera, event, sensitivity, deltaTimeSec);
+					break;
+				}
+				case SDL_KEYDOWN:
+				{
+					if (event.key.keysym.scancode == SDL_SCANCODE_H && !event.key.repeat)
+						renderModeRequested = true;
+					if (event.key.keysym.scancode == SDL_SCANCODE_P && !event.key.repeat)
+						progressiveRequested = true;
+					if (event.key.keysym.scancode == SDL_SCANCODE_G && !event.key.repeat)
+						adaptiveRequested = true;
+					if (event.key.keysym.scancode == SDL_SCANCODE_T && !event.key.repeat)
+						temporalRequested = true;
+					if (event.key.keysym.scancode == SDL_SCANCODE_B && !event.key.repeat)
+						wavefrontRequested = true;
+					if (event.key.keysym.scancode == SDL_SCANCODE_M && !event.key.repeat)
+						toneMapRequested = true;
+					break;
+				}
+				default:
+					break;
+				}
 			}
+
+			computeKeyboardInput(cameraController, speed, deltaTimeSec);
+		}
+
+		{
+			PROFILE_SCOPE("wait for frame");
+			raytracer.endRender();
+			tracing = false;
+		}
+		if (!raytracer.isProgressive())
+			resolution.addFrame(raytracer.getFrameMilliseconds());
+		duplicateFramebufferEdges(textures[tracedTexture], framebuffer);
+		{
+			PROFILE_SCOPE("SDL_UnlockTexture");
+			SDL_UnlockTexture(textures[tracedTexture]);
+		}
+
+		if (renderModeRequested)
+		{
+			cycleRenderMode(raytracer);
+			renderModeRequested = false;
+		}
+
+		if (progressiveRequested)
+		{
+			raytracer.setProgressive(!raytracer.isProgressive());
+			std::cout << "Progressive refinement: " << (raytracer.isProgressive() ? "on" : "off") << std::endl;
+			progressiveRequested = false;
+		}
+
+		// adaptive sampling, temporal reuse and wavefront tracing only apply while progressive refinement is off
+		const char* suppressedNote = raytracer.isProgressive() ? " (inactive until progressive refinement is off)" : "";
+
+		if (adaptiveRequested)
+		{
+			raytracer.setAdaptive(!raytracer.isAdaptive());
+			std::cout << "Adaptive sampling: " << (raytracer.isAdaptive() ? "on" : "off") << suppressedNote << std::endl;
+			adaptiveRequested = false;
 		}
 
-		computeKeyboardInput(cameraController, speed, deltaTimeSec);
+		if (temporalRequested)
+		{
+			raytracer.setTemporalReuse(!raytracer.isTemporalReuse());
+			std::cout << "Temporal reuse: " << (raytracer.isTemporalReuse() ? "on" : "off") << suppressedNote << std::endl;
+			temporalRequested = false;
+		}
+
+		if (wavefrontRequested)
+		{
+			raytracer.setWavefront(!raytracer.isWavefront());
+			std::cout << "Wavefront tracing: " << (raytracer.isWavefront() ? "on" : "off") << suppressedNote << std::endl;
+			wavefrontRequested = false;
+		}
+
+		if (toneMapRequested)
+		{
+			ToneMapper toneMapper = raytracer.getToneMapper();
+			const bool reinhard = toneMapper.getOperator() == ToneMapOperator::Reinhard;
+			toneMapper.setOperator(reinhard ? ToneMapOperator::Clamp : ToneMapOperator::Reinhard);
+			raytracer.setToneMapper(toneMapper);
+			std::cout << "Tone mapping: " << (reinhard ? "clamp" : "reinhard") << std::endl;
+			toneMapRequested = false;
+		}
+
+		const int presentedTexture = tracedTexture;
+		tracedTexture = (tracedTexture + 1) % frameBufferCount;
+		SDL_Rect& region = tracedRegions[tracedTexture];
+		computeRenderSize(region);
+		if (running && lockFramebuffer(textures[tracedTexture], layout, region.w, region.h, framebuffer))
+		{
+			raytracer.beginRender(framebuffer);
+			tracing = true;
+		}
 
 		SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xFF);
 		SDL_RenderClear(renderer);
-		raytracer.render(renderer, surface, texture);
-		SDL_RenderPresent(renderer);
+		{
+			PROFILE_SCOPE("SDL_RenderCopy");
+			SDL_RenderCopy(renderer, textures[presentedTexture], &tracedRegions[presentedTexture], nullptr);
+		}
+		{
+			PROFILE_SCOPE("SDL_RenderPresent");
+			SDL_RenderPresent(renderer);
+		}
 
 		frameTime = SDL_GetTicks64() - frameStart;
-		//std::cout << "Frame time: " << frameTime << "ms" << std::endl;
+
+#if RAYTRACER_ENABLE_STATS
+		if (SDL_GetTicks64() - lastStatsUpdate >= statsInterval)
+		{
+			const std::string stats = RayStats::format(raytracer.getFrameStats(), raytracer.getFrameMilliseconds());
+			std::string size = std::to_string(tracedRegions[presentedTexture].w) + "x" + std::to_string(tracedRegions[presentedTexture].h);
+			if (raytracer.isProgressive())
+				size += " | " + std::to_string(raytracer.getAccumulatedSamples()) + " spp";
+			SDL_SetWindowTitle(window, ("Raytracer | " + size + " | " + stats).c_str());
+			std::cout << stats << std::endl;
+			lastStatsUpdate = SDL_GetTicks64();
+		}
+#endif
 
 		if (frameDelay > frameTime)
 		{
+			PROFILE_SCOPE("delay");
 			SDL_Delay(frameDelay - frameTime);
 			deltaTimeSec = static_cast<float>(frameTime + (frameDelay - frameTime)) / 1000.f;
 		}
@@ -176,8 +445,21 @@ int main()
 		}
 	}
 
-	SDL_DestroyTexture(texture);
-	SDL_FreeSurface(surface);
+	if (tracing)
+	{
+		raytracer.endRender();
+		SDL_UnlockTexture(textures[tracedTexture]);
+	}
+
+	if (!tracePath.empty())
+	{
+		Profiler::stop();
+		if (!Profiler::writeChromeTrace(tracePath))
+			std::cerr << "Failed to write " << tracePath << std::endl;
+	}
+
+	for (SDL_Texture* texture : textures)
+		SDL_DestroyTexture(texture);
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
 	SDL_Quit();